@@ -0,0 +1,68 @@
+/*
+* Copyright (c) 2018 Intel Corporation.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef ASSOCIATION_H_INCLUDED
+#define ASSOCIATION_H_INCLUDED
+
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+/* AssociationGate limits which tracked centroids a detected point can be associated with: the points
+   must be at most max_distance apart and their X and Y coordinates may differ by at most max_dx and max_dy */
+struct AssociationGate {
+    int max_distance;
+    int max_dx;
+    int max_dy;
+};
+
+/* CentroidGrid is a uniform grid index over a set of points. The cell size equals the gate distance,
+   so all the candidates of a query lie in the 3x3 cells around it. The index keeps its buffers between
+   builds, so rebuilding it every frame does not allocate once it has grown */
+class CentroidGrid {
+public:
+    // build indexes the points with the given cell size
+    void build(const std::vector<cv::Point>& points, int cell);
+
+    // query appends the indexes of the indexed points within the gate of p to out
+    void query(cv::Point p, const AssociationGate& gate, std::vector<int>& out) const;
+
+private:
+    uint64_t key(int cx, int cy) const;
+
+    int cell;
+    const std::vector<cv::Point>* points;
+    // cells holds the cell key and the index of every point, sorted by the cell key
+    std::vector<std::pair<uint64_t, int> > cells;
+};
+
+/* assignPoints associates the detected points with the tracked points so that the number of associations
+   is the largest possible and their total distance is the smallest, considering only the pairs within the gate.
+   The gating graph is split into connected components which are solved one by one with the Hungarian algorithm.
+   Returns the index of the tracked point associated with every detected point, or -1 */
+std::vector<int> assignPoints(const std::vector<cv::Point>& points, const std::vector<cv::Point>& tracked,
+                              const AssociationGate& gate);
+
+#endif
@@ -0,0 +1,187 @@
+/*
+* Copyright (c) 2018 Intel Corporation.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef BOUNDED_QUEUE_H_INCLUDED
+#define BOUNDED_QUEUE_H_INCLUDED
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <utility>
+
+/* QueuePolicy decides what happens to an item pushed to a full BoundedQueue. DROP_NEWEST drops the pushed item,
+   DROP_OLDEST drops the oldest queued items to make room for it, LATEST replaces all the queued items with it,
+   and BLOCK waits for the consumer to make room */
+enum QueuePolicy {
+    DROP_NEWEST,
+    DROP_OLDEST,
+    LATEST,
+    BLOCK
+};
+
+// parseQueuePolicy sets policy to the policy with the given name, it returns false for an unknown name
+inline bool parseQueuePolicy(const std::string& name, QueuePolicy& policy) {
+    if (name == "drop_newest") {
+        policy = DROP_NEWEST;
+    } else if (name == "drop_oldest") {
+        policy = DROP_OLDEST;
+    } else if (name == "latest") {
+        policy = LATEST;
+    } else if (name == "block") {
+        policy = BLOCK;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/* BoundedQueue is a queue for a single producer and a single consumer which holds at most max_items items and
+   max_bytes bytes. The size in bytes of an item is given when it is pushed, a single item is always let in even
+   when it is larger than max_bytes on its own. Unlike SpscRing, the producer can drop queued items, so both sides
+   take a short lock. A max of 0 lifts the limit */
+template <typename T>
+class BoundedQueue {
+public:
+    BoundedQueue() : max_items(0), max_bytes(0), policy(DROP_NEWEST), closed(false), count(0), bytes(0),
+                     peak(0), drops(0) {}
+
+    // configure sets the limits and the policy of the queue, it must be called before the queue is used
+    void configure(size_t items, size_t size, QueuePolicy queue_policy) {
+        max_items = items;
+        max_bytes = size;
+        policy = queue_policy;
+    }
+
+    /* push adds an item of the given size to the queue, applying the policy when the queue is full. It returns
+       false when the item was dropped, or when the queue was closed while waiting for room. evicted is set to
+       the number of queued items dropped to make room for the item, which the consumer will never see */
+    bool push(const T& item, size_t size, size_t& evicted) {
+        std::unique_lock<std::mutex> lock(m);
+        evicted = 0;
+        if (policy == LATEST) {
+            evicted += dropAll();
+        }
+        while (!fits(size)) {
+            if (closed || policy == DROP_NEWEST) {
+                drops++;
+                return false;
+            }
+            if (policy == BLOCK) {
+                not_full.wait(lock);
+                continue;
+            }
+            dropFront();
+            evicted++;
+        }
+        items.push_back(Entry(item, size));
+        count = items.size();
+        bytes += size;
+        if (bytes > peak) {
+            peak = bytes.load();
+        }
+        return true;
+    }
+
+    // pop takes the oldest item off the queue, returns false without blocking when the queue is empty
+    bool pop(T& item) {
+        std::lock_guard<std::mutex> lock(m);
+        if (items.empty()) {
+            return false;
+        }
+        item = std::move(items.front().first);
+        bytes -= items.front().second;
+        items.pop_front();
+        count = items.size();
+        not_full.notify_one();
+        return true;
+    }
+
+    // close wakes up a blocked producer and makes every later push drop its item
+    void close() {
+        std::lock_guard<std::mutex> lock(m);
+        closed = true;
+        not_full.notify_all();
+    }
+
+    // size returns the number of queued items
+    size_t size() const {
+        return count.load();
+    }
+
+    // queuedBytes returns the size of the queued items in bytes
+    size_t queuedBytes() const {
+        return bytes.load();
+    }
+
+    // peakBytes returns the largest size of the queued items so far
+    size_t peakBytes() const {
+        return peak.load();
+    }
+
+    // dropped returns the number of items dropped by the policy
+    long dropped() const {
+        return drops.load();
+    }
+
+private:
+    typedef std::pair<T, size_t> Entry;
+
+    bool fits(size_t size) const {
+        if (items.empty()) {
+            return true;
+        }
+        return (max_items == 0 || items.size() < max_items) && (max_bytes == 0 || bytes + size <= max_bytes);
+    }
+
+    void dropFront() {
+        bytes -= items.front().second;
+        items.pop_front();
+        count = items.size();
+        drops++;
+    }
+
+    size_t dropAll() {
+        size_t dropped = items.size();
+        while (!items.empty()) {
+            dropFront();
+        }
+        return dropped;
+    }
+
+    size_t max_items;
+    size_t max_bytes;
+    QueuePolicy policy;
+    bool closed;
+    std::mutex m;
+    std::condition_variable not_full;
+    std::deque<Entry> items;
+    // The counters are written under the lock but can be read from any thread
+    std::atomic<size_t> count;
+    std::atomic<size_t> bytes;
+    std::atomic<size_t> peak;
+    std::atomic<long> drops;
+};
+
+#endif
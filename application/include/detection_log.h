@@ -0,0 +1,116 @@
+/*
+* Copyright (c) 2018 Intel Corporation.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef DETECTION_LOG_H_INCLUDED
+#define DETECTION_LOG_H_INCLUDED
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+#include <opencv2/core.hpp>
+
+/* A detection log holds the raw detector output of every frame of a single input, so the tracker can be run
+   again on it without decoding the video or running the network. The file is a DetectionLogHeader followed by
+   one DetectionRecord per frame, each followed by its detection rows. All the fields are in native byte order
+   and all the sizes are multiples of 4 bytes, so the rows can be read in place from a memory mapped file */
+
+// DetectionLogHeader describes the input the detections were recorded from
+struct DetectionLogHeader {
+    // magic is "PLDL"
+    char magic[4];
+    uint32_t version;
+    // width and height are the size of the video frames
+    int32_t width;
+    int32_t height;
+    // roi is the region of the frame the detection coordinates are relative to
+    int32_t roi_x;
+    int32_t roi_y;
+    int32_t roi_width;
+    int32_t roi_height;
+    // row_size is the number of floats of a detection row
+    uint32_t row_size;
+    uint32_t reserved;
+};
+
+// DetectionRecord precedes the detection rows of a frame
+struct DetectionRecord {
+    // frame is the index of the frame in the input
+    uint32_t frame;
+    // mode is the FrameMode of the frame, only detected frames have rows
+    uint32_t mode;
+    // rows is the number of detection rows which follow the record
+    uint32_t rows;
+    uint32_t reserved;
+    // timestamp is the time the frame was tracked at, in microseconds since the epoch
+    int64_t timestamp;
+};
+
+/* DetectionWriter appends the detections of a stream to a log file. The header is written with the first frame,
+   once the frame size is known. A writer must only be used from a single thread */
+class DetectionWriter {
+public:
+    DetectionWriter();
+    ~DetectionWriter();
+
+    // open creates the log file at path and returns false when it can't be created
+    bool open(const std::string& path);
+    /* write appends the count detection rows of a frame, each of row_size floats. size is the frame size and
+       roi the region the rows are relative to, only the ones of the first frame are used */
+    void write(uint32_t frame, int mode, int64_t timestamp, const float* rows, size_t count, size_t row_size,
+               cv::Size size, cv::Rect roi);
+    void close();
+    bool isOpen() const;
+
+private:
+    FILE* file;
+    bool header_written;
+};
+
+/* DetectionReader maps a log file into memory and walks through its frames. The rows are handed out as pointers
+   into the mapping, so reading a frame doesn't copy or allocate anything */
+class DetectionReader {
+public:
+    DetectionReader();
+    ~DetectionReader();
+
+    // open maps the log file at path and returns false when it can't be read or isn't a detection log
+    bool open(const std::string& path);
+    const DetectionLogHeader& header() const;
+    // size returns the frame size of the recorded input
+    cv::Size size() const;
+    // roi returns the region of the frame the detection coordinates are relative to
+    cv::Rect roi() const;
+    /* next reads the record of the next frame and points rows at its detection rows. It returns false at the end
+       of the log, or when the last frame was cut short */
+    bool next(DetectionRecord& record, const float*& rows);
+    void close();
+
+private:
+    const char* data;
+    size_t length;
+    size_t offset;
+    DetectionLogHeader head;
+};
+
+#endif
@@ -0,0 +1,67 @@
+/*
+* Copyright (c) 2018 Intel Corporation.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef DETECTIONS_H_INCLUDED
+#define DETECTIONS_H_INCLUDED
+
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "tracker.h"
+
+// FrameMode tells how the cars of a frame are found
+enum FrameMode {
+    // The frame went through the detector
+    DETECTED,
+    // The frame is in between the detection stride, the tracked cars are moved ahead with their velocity
+    PREDICTED,
+    // The motion gate found no motion near the entrance, the frame has no cars and the tracked ones age
+    IDLE
+};
+
+// DetectionFilter decides which detector output rows are taken as cars
+struct DetectionFilter {
+    // confidence is the confidence factor a car detection requires
+    float confidence;
+    // min_size is the minimum width and height in pixels of a car rectangle
+    int min_size;
+    /* clip_width and clip_height limit the size of car rectangles, which sometimes stretch way over the
+       actual car dimensions and skew the centroid positions */
+    int clip_width;
+    int clip_height;
+};
+
+// TrackTimings receives the time in microseconds trackDetections spent on each of its steps
+struct TrackTimings {
+    long decode_us;
+    long associate_us;
+    long count_us;
+};
+
+std::vector<cv::Point> decodeDetections(const float* rows, size_t count, cv::Size size, cv::Rect roi,
+                                        const DetectionFilter& filter);
+void trackDetections(CounterContext& ctx, FrameMode mode, const float* rows, size_t count, cv::Size size,
+                     cv::Rect roi, const DetectionFilter& filter, int stride, TrackTimings* timings = NULL);
+
+#endif
@@ -0,0 +1,58 @@
+/*
+* Copyright (c) 2018 Intel Corporation.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef FRAME_POOL_H_INCLUDED
+#define FRAME_POOL_H_INCLUDED
+
+#include <atomic>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/videoio.hpp>
+
+/* FramePool owns a fixed set of frame buffers which video frames are decoded into. A buffer is handed
+   out as a shallow Mat and is reused once the OpenCV reference count shows that the pool holds the only
+   reference left, so in steady state capturing a frame does not allocate any memory.
+   read must only be called from a single thread, the statistics can be read from any thread */
+class FramePool {
+public:
+    explicit FramePool(size_t size);
+
+    /* read decodes the next frame of cap into a free pooled buffer and returns a reference to it in frame.
+       It returns false when all the buffers are still in use, in which case nothing is read.
+       frame is left empty when the video source is exhausted */
+    bool read(cv::VideoCapture& cap, cv::Mat& frame);
+
+    // allocations returns the number of times a frame buffer had to be allocated
+    long allocations() const;
+    // frames returns the number of frames read into the pool
+    long frames() const;
+
+private:
+    std::vector<cv::Mat> buffers;
+    size_t next;
+    std::atomic<long> allocs;
+    std::atomic<long> reads;
+};
+
+#endif
@@ -0,0 +1,122 @@
+/*
+* Copyright (c) 2018 Intel Corporation.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef JOURNAL_H_INCLUDED
+#define JOURNAL_H_INCLUDED
+
+#include <stdint.h>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/* A message journal keeps the MQTT messages which can't be sent while the broker is unreachable, so they are sent
+   once it is back, even when the application was restarted in between. The file is a JournalHeader followed by
+   one JournalRecord per message, each followed by its topic and payload and padded to a multiple of 8 bytes.
+   The file is memory mapped and has a fixed capacity, so appending a message is a copy into the mapping. The
+   messages between the read and the write offset are still to be sent. The read offset only moves past a message
+   once the broker acknowledged it, so a message taken but lost with the connection or a crash is sent again.
+   Once all of them are acknowledged the journal starts over from the front. All the fields are in native byte
+   order */
+
+// JournalHeader describes the part of the journal which is still to be sent
+struct JournalHeader {
+    // magic is "PLMJ"
+    char magic[4];
+    uint32_t version;
+    // capacity is the size of the journal file
+    uint64_t capacity;
+    // read_offset is the offset of the first message not acknowledged yet
+    uint64_t read_offset;
+    // write_offset is the offset the next message is appended at
+    uint64_t write_offset;
+};
+
+// JournalRecord precedes the topic and the payload of a message
+struct JournalRecord {
+    uint32_t topic_size;
+    uint32_t payload_size;
+    // coalesce is set when only the last message of the topic matters
+    uint32_t coalesce;
+    uint32_t reserved;
+};
+
+// JournalMessage is a message taken from the journal
+struct JournalMessage {
+    std::string topic;
+    std::string payload;
+    bool coalesce;
+    // end is the offset right after the message in the journal, which identifies it to acknowledge
+    uint64_t end;
+};
+
+/* MessageJournal appends messages to a journal file and takes them back in order. Of the messages with coalesce
+   set, only the last one of every topic is handed out, the older ones were replaced before they could be sent.
+   A journal is not synchronized, the caller has to serialize its use */
+class MessageJournal {
+public:
+    MessageJournal();
+    ~MessageJournal();
+
+    /* open maps the journal file at path, creating it with the given capacity in bytes when it doesn't exist yet.
+       The messages of an existing journal are kept. It returns false when the file can't be used */
+    bool open(const std::string& path, size_t capacity);
+    void close();
+    bool isOpen() const;
+
+    // append adds a message at the end of the journal, it returns false when the journal is full
+    bool append(const std::string& topic, const char* payload, size_t size, bool coalesce);
+    /* take copies up to max of the messages which were not taken yet to messages and returns their number.
+       They stay in the journal until they are acknowledged */
+    size_t take(std::vector<JournalMessage>& messages, size_t max);
+    /* acknowledge marks the taken message which ends at end as sent. The read offset moves past all the messages
+       up to the first one still waiting for its acknowledgement */
+    void acknowledge(uint64_t end);
+    // empty returns true when every message was taken
+    bool empty() const;
+    // size returns the number of messages which were not taken yet
+    size_t size() const;
+
+private:
+    JournalHeader* header();
+    const JournalHeader* header() const;
+    // recordSize returns the size of a record with its topic and payload, including the padding
+    static size_t recordSize(size_t topic_size, size_t payload_size);
+    // scan counts the messages of the journal and finds the last coalesced message of every topic
+    void scan();
+    // commit moves the read offset past the acknowledged messages at the front of the taken ones
+    void commit();
+
+    char* data;
+    size_t length;
+    size_t count;
+    // next_offset is the offset of the next message to take, it is only kept in memory
+    uint64_t next_offset;
+    // taken holds the end offset of every taken message in order, and whether it was acknowledged
+    std::deque<std::pair<uint64_t, bool> > taken;
+    // last_coalesced maps a topic to the offset of its last coalesced message in the journal
+    std::unordered_map<std::string, uint64_t> last_coalesced;
+};
+
+#endif
@@ -0,0 +1,60 @@
+/*
+* Copyright (c) 2018 Intel Corporation.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef METRICS_H_INCLUDED
+#define METRICS_H_INCLUDED
+
+#include <atomic>
+#include <chrono>
+#include <vector>
+
+/* LatencyHistogram counts durations in microseconds in log-linear buckets: exact up to 15 us, then 8 buckets
+   per power of two, so a percentile is off by at most 12.5%. Recording is a single relaxed atomic increment,
+   so any number of threads can record while another one reads the counts */
+class LatencyHistogram {
+public:
+    static const int linear = 16;
+    static const int sub_buckets = 8;
+    static const int bucket_count = linear + 36 * sub_buckets;
+
+    LatencyHistogram();
+
+    void record(long us);
+    // recordSince records the time passed since start
+    void recordSince(std::chrono::steady_clock::time_point start);
+    // snapshot copies the current bucket counts into counts
+    void snapshot(std::vector<long>& counts) const;
+
+    // bucketLimit returns the largest duration which falls into the bucket
+    static long bucketLimit(int bucket);
+    // total returns the number of durations in a snapshot
+    static long total(const std::vector<long>& counts);
+    // percentile returns the duration q of the durations of a snapshot are at most, q is between 0 and 1
+    static long percentile(const std::vector<long>& counts, double q);
+
+private:
+    static int bucketOf(long us);
+    std::atomic<long> buckets[bucket_count];
+};
+
+#endif
@@ -0,0 +1,55 @@
+/*
+* Copyright (c) 2018 Intel Corporation.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef MOTION_H_INCLUDED
+#define MOTION_H_INCLUDED
+
+#include <string>
+
+#include <opencv2/core.hpp>
+
+/* MotionGate is a cheap pre-filter which decides whether a frame is worth sending to the car detector.
+   It compares a small grayscale copy of the band along the entrance edge with the one of the previous
+   frame, and keeps the gate open for hold frames after the last motion, so cars which stop at the
+   entrance are still detected for a while. All the buffers are reused between frames */
+class MotionGate {
+public:
+    MotionGate();
+
+    /* init sets the entrance edge (b, t, l or r), the band size as a fraction of the frame size
+       and the fraction of changed pixels in the band which counts as motion */
+    void init(const std::string& entrance, double band, double threshold, int hold);
+
+    // update returns true when the frame has to go through the detector
+    bool update(const cv::Mat& frame);
+
+private:
+    std::string entrance;
+    double band;
+    double changed_ratio;
+    int hold;
+    int since_motion;
+    cv::Mat small, gray, prev, diff;
+};
+
+#endif
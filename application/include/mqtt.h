@@ -27,24 +27,30 @@
 #include <stdlib.h>
 #include <iostream>
 #include <sstream>
+#include <string>
 #include <utility>
 #include <vector>
 #include <tuple>
 #include <cstring>
 
 extern "C" {
-    #include "MQTTClient.h"
+    #include "MQTTAsync.h"
     #include "MQTTClientPersistence.h"
 }
 
 #define QOS 1
 #define TIMEOUT 1000L
+// Max number of messages waiting in the outbound queue, the oldest one is dropped when it is full
+#define MQTT_QUEUE_SIZE 256
+// Max number of published messages waiting for their acknowledgement
+#define MQTT_MAX_INFLIGHT 16
+// Number of journaled messages moved to the outbound queue at a time
+#define MQTT_JOURNAL_BATCH 64
 
 struct mqtt_service_config
 {
     std::string server;
     std::string client_id;
-    std::string topic;
     std::string username;
     std::string password;
     std::string cert;
@@ -52,13 +58,28 @@ struct mqtt_service_config
     std::string ca_root;
 };
 
+// mqtt_publisher_stats counts what happened to the messages handed to mqtt_publish
+struct mqtt_publisher_stats
+{
+    long queued;
+    long inflight;
+    long sent;
+    long failed;
+    long coalesced;
+    long dropped;
+    long journaled;
+};
+
 std::string std_getenv(const std::string &name);
 std::pair<mqtt_service_config, bool> get_mqtt_config();
-int mqtt_start(MQTTClient_messageArrived* msgrcv);
+int mqtt_start(MQTTAsync_messageArrived* msgrcv);
+bool mqtt_journal(std::string const &path, size_t capacity);
 void mqtt_close();
 void mqtt_connect();
 void mqtt_disconnect();
-int mqtt_publish(std::string const &topic, std::string const &message);
+int mqtt_publish(std::string const &topic, std::string const &message, bool coalesce = true);
+int mqtt_publish_payload(std::string const &topic, const char *payload, size_t size, bool coalesce = true);
 void mqtt_subscribe(std::string const &topic);
+mqtt_publisher_stats mqtt_stats();
 
 #endif
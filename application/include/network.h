@@ -0,0 +1,45 @@
+/*
+* Copyright (c) 2018 Intel Corporation.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef NETWORK_H_INCLUDED
+#define NETWORK_H_INCLUDED
+
+#include <string>
+
+#include <opencv2/core.hpp>
+#include <opencv2/dnn.hpp>
+
+/* useNetworkCache keeps the compiled form of the network on disk in a directory of dir for the backend and
+   target, so a restart loads it instead of compiling the network again. It points the caches OpenCV and the
+   Inference Engine already have for the targets which compile the network to it: the compiled network of the
+   Inference Engine GPU plugin, the OpenCL program binaries and the tuned OpenCL convolutions. A cache set in
+   the environment is left alone. It must be called before the network is read, and returns the directory,
+   or an empty string when it can't be created */
+std::string useNetworkCache(const std::string& dir, int backend, int target);
+
+/* warmUpNetwork runs runs forward passes of a batch of black frames of the given size through net, so the
+   network is compiled and its buffers are allocated before the first frame. Returns the time of the first
+   pass in milliseconds */
+double warmUpNetwork(cv::dnn::Net& net, int batch, cv::Size size, int runs);
+
+#endif
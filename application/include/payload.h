@@ -0,0 +1,83 @@
+/*
+* Copyright (c) 2018 Intel Corporation.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef PAYLOAD_H_INCLUDED
+#define PAYLOAD_H_INCLUDED
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "tracker.h"
+
+/* The counts and the count events of an input are published in one of several encodings. JSON is the readable
+   default, CBOR and MessagePack carry the same objects in fewer bytes, and the binary form is a fixed layout
+   which needs no field names at all. All the multi-byte fields of the binary form are little endian:
+
+     counts:  'P' 'C' version:u8 0:u8  total_in:i32 total_out:i32
+     events:  'P' 'C' version:u8 1:u8  total_in:i32 total_out:i32 count:u32
+              then count times  id:i32 direction:i8 time:i64 */
+
+enum PayloadFormat {
+    PAYLOAD_JSON,
+    PAYLOAD_CBOR,
+    PAYLOAD_MSGPACK,
+    PAYLOAD_BINARY
+};
+
+// StampedEvent is a counted car together with the time it was counted, in milliseconds since the epoch
+struct StampedEvent {
+    CountEvent event;
+    long long time;
+};
+
+// parsePayloadFormat sets format to the encoding with the given name, it returns false for an unknown name
+bool parsePayloadFormat(const std::string& name, PayloadFormat& format);
+const char* payloadFormatName(PayloadFormat format);
+
+/* PayloadEncoder encodes the messages into a buffer it owns. The buffer keeps its capacity from one message to the
+   next, so once it has grown to the largest message, encoding doesn't allocate. The encoded message stays valid
+   until the next call, an encoder must not be shared between threads */
+class PayloadEncoder {
+public:
+    explicit PayloadEncoder(PayloadFormat format = PAYLOAD_JSON);
+
+    PayloadFormat format() const { return format_; }
+    // counts encodes the counts of info
+    void counts(const ParkingInfo& info);
+    // events encodes the counted cars together with the counts of info
+    void events(const ParkingInfo& info, const std::vector<StampedEvent>& events);
+
+    const char* data() const { return (const char*)buffer_.data(); }
+    size_t size() const { return buffer_.size(); }
+
+private:
+    void appendText(const char* text);
+    void appendNumber(long long value);
+    void appendBinary(uint64_t value, int bytes);
+
+    PayloadFormat format_;
+    std::vector<uint8_t> buffer_;
+};
+
+#endif
@@ -0,0 +1,76 @@
+/*
+* Copyright (c) 2018 Intel Corporation.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef PREPROCESS_H_INCLUDED
+#define PREPROCESS_H_INCLUDED
+
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+/* BlendKernel selects the variant of the vertical pass of BlobResizer. BLEND_AUTO picks the fastest one the
+   processor supports, the others are there to check every variant against blobFromImage */
+enum BlendKernel {
+    BLEND_AUTO,
+    BLEND_SCALAR,
+    BLEND_SSE2,
+    BLEND_AVX2
+};
+
+/* BlobResizer turns 8-bit BGR images into the planar float input blob of the network in a single pass over the
+   output rows: every row is interpolated, converted to float and written to its 3 channel planes at once, with
+   the fixed point bilinear arithmetic of cv::resize. There is no intermediate resized image and no channel split,
+   and the result is the one of blobFromImages with a scale factor of 1, no mean and no channel swap.
+   The interpolation tables and the row buffers are reused as long as the sizes do not change */
+class BlobResizer {
+public:
+    explicit BlobResizer(BlendKernel kernel = BLEND_AUTO);
+
+    // supported returns true when the kernel variant is built in and the processor can run it
+    static bool supported(BlendKernel kernel);
+
+    // batch writes the images resized to size into blob, which is only reallocated when its shape changes
+    void batch(const std::vector<cv::Mat>& images, cv::Mat& blob, cv::Size size);
+
+    /* resize writes image resized to size into out as 3 planes of size.area() floats. Images which are not
+       8-bit 3 channel, or which cv::resize would shrink by half with area interpolation, go through blobFromImage */
+    void resize(const cv::Mat& image, cv::Size size, float* out);
+
+private:
+    void prepare(cv::Size from, cv::Size to);
+    void interpolateRow(const unsigned char* src, int* dst) const;
+
+    BlendKernel kernel;
+    cv::Size from, to;
+    // Byte offsets of the left and the right source pixel of every output column and their weights
+    std::vector<int> xofs;
+    std::vector<short> alpha;
+    // Upper source row of every output row and the weights of the upper and the lower row
+    std::vector<int> yofs;
+    std::vector<short> beta;
+    // Two horizontally interpolated source rows, as 3 channel planes of to.width values each
+    std::vector<int> rows;
+    cv::Mat fallback;
+};
+
+#endif
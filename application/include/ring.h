@@ -0,0 +1,123 @@
+/*
+* Copyright (c) 2018 Intel Corporation.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef RING_H_INCLUDED
+#define RING_H_INCLUDED
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/* SpscRing is a bounded lock-free queue for a single producer thread and a single consumer thread.
+   Producer and consumer only synchronize through the head and tail indexes, which live on separate
+   cache lines, so pushing and popping never takes a lock */
+template <typename T>
+class SpscRing {
+public:
+    explicit SpscRing(size_t capacity) : slots(capacity + 1), head(0), tail(0) {}
+
+    // push adds an item to the ring, returns false without blocking when the ring is full
+    bool push(const T& item) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t next = increment(t);
+        if (next == head.load(std::memory_order_acquire)) {
+            return false;
+        }
+        slots[t] = item;
+        tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    // pop takes the oldest item off the ring, returns false without blocking when the ring is empty
+    bool pop(T& item) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = std::move(slots[h]);
+        // Drop whatever the slot still references, e.g. the buffer of a frame
+        slots[h] = T();
+        head.store(increment(h), std::memory_order_release);
+        return true;
+    }
+
+    // size returns the number of queued items, exact only when called from the producer or the consumer
+    size_t size() const {
+        size_t h = head.load(std::memory_order_acquire);
+        size_t t = tail.load(std::memory_order_acquire);
+        return t >= h ? t - h : t + slots.size() - h;
+    }
+
+    size_t capacity() const {
+        return slots.size() - 1;
+    }
+
+private:
+    size_t increment(size_t i) const {
+        return ++i == slots.size() ? 0 : i;
+    }
+
+    std::vector<T> slots;
+    // Padding keeps the consumer and the producer index on separate cache lines
+    char pad0[64];
+    std::atomic<size_t> head;
+    char pad1[64 - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> tail;
+    char pad2[64 - sizeof(std::atomic<size_t>)];
+};
+
+/* Backoff is the wait policy used while a ring has nothing to pop or no room to push. It spins for
+   a short while to keep latency low when data is about to arrive, then yields the CPU, and finally
+   sleeps for growing intervals so an idle stage does not burn a core */
+class Backoff {
+public:
+    Backoff() : count(0) {}
+
+    void pause() {
+        if (count < spin_limit) {
+            count++;
+        } else if (count < yield_limit) {
+            count++;
+            std::this_thread::yield();
+        } else {
+            int shift = count - yield_limit < 5 ? count++ - yield_limit : 5;
+            std::this_thread::sleep_for(std::chrono::microseconds(min_sleep_us << shift));
+        }
+    }
+
+    // reset restarts the policy from spinning after the waiting thread got work to do
+    void reset() {
+        count = 0;
+    }
+
+private:
+    static const int spin_limit = 64;
+    static const int yield_limit = 128;
+    // Sleeps double from min_sleep_us up to 32 * min_sleep_us
+    static const int min_sleep_us = 50;
+    int count;
+};
+
+#endif
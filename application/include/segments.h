@@ -0,0 +1,81 @@
+/*
+* Copyright (c) 2018 Intel Corporation.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef SEGMENTS_H_INCLUDED
+#define SEGMENTS_H_INCLUDED
+
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "tracker.h"
+
+/* A long video is counted in segments side by side, each with its own tracker. Segment k counts the cars of the
+   frames from start to end, but its tracker already runs from overlap frames before start, so the cars in view at
+   start are tracked, and keeps running until overlap frames after end, so the cars in view at end are followed
+   until they leave. At the boundary between two segments, the cars in view of both trackers are matched by their
+   position. A matched car is counted by the earlier segment for as long as it tracks it, and by the later segment
+   after that. A car in view of only one of the trackers at the boundary is counted by the later segment, as the
+   earlier one didn't see it or loses it right away */
+
+// Segment is the range of frames of a segment
+struct Segment {
+    // start and end are the frames counted by the segment, end excluded
+    long start;
+    long end;
+    // first and last are the frames tracked by the segment, last excluded
+    long first;
+    long last;
+};
+
+// SegmentCar is a car in view of the tracker of a segment
+struct SegmentCar {
+    int id;
+    cv::Point p;
+};
+
+// SegmentEvent is a car counted by the tracker of a segment at the given frame
+struct SegmentEvent {
+    long frame;
+    CountEvent event;
+};
+
+// SegmentResult holds what the tracker of a segment saw
+struct SegmentResult {
+    Segment segment;
+    // events lists all the cars counted by the tracker, including the ones outside of the counted frames
+    std::vector<SegmentEvent> events;
+    // entry lists the cars in view once frame start-1 is tracked, exit the cars in view once frame end-1 is tracked
+    std::vector<SegmentCar> entry;
+    std::vector<SegmentCar> exit;
+};
+
+// planSegments splits frames into count segments of about the same length, tracked with overlap frames around them
+std::vector<Segment> planSegments(long frames, int count, long overlap);
+// segmentCars returns the cars in view of the tracker
+std::vector<SegmentCar> segmentCars(const CounterContext& ctx);
+/* stitchSegments adds up the cars counted by the segments, in their order, into total_in and total_out.
+   Cars at a boundary are matched when they are at most max_distance pixels apart */
+void stitchSegments(const std::vector<SegmentResult>& results, int max_distance, int& total_in, int& total_out);
+
+#endif
@@ -0,0 +1,107 @@
+/*
+* Copyright (c) 2018 Intel Corporation.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+#ifndef SNAPSHOT_H_INCLUDED
+#define SNAPSHOT_H_INCLUDED
+
+#include <atomic>
+#include <cstddef>
+
+/* Snapshots publishes values from a single writer thread to any number of reader threads without a lock.
+   The values live in a fixed set of slots, current is the index of the published one. A reader marks the
+   slot it reads, the writer only fills a slot which is neither published nor marked, so a published value
+   is never modified while it is read. A reader retries only when the writer published a new value in between,
+   and the writer never waits. With N slots, up to N - 2 readers can hold a value at the same time while the
+   writer still finds a free slot */
+template <typename T, size_t N = 4>
+class Snapshots {
+public:
+    // Reader holds a published value, the writer does not reuse its slot until the reader is destroyed
+    class Reader {
+    public:
+        Reader(Reader&& other) : owner(other.owner), slot(other.slot) {
+            other.owner = NULL;
+        }
+        ~Reader() {
+            if (owner != NULL) {
+                owner->readers[slot].fetch_sub(1, std::memory_order_release);
+            }
+        }
+
+        const T& operator*() const { return owner->slots[slot]; }
+        const T* operator->() const { return &owner->slots[slot]; }
+
+    private:
+        friend class Snapshots;
+        Reader(const Snapshots* snapshots, size_t index) : owner(snapshots), slot(index) {}
+        Reader(const Reader&);
+        Reader& operator=(const Reader&);
+
+        const Snapshots* owner;
+        size_t slot;
+    };
+
+    Snapshots() : slots(), current(0) {
+        for (size_t k = 0; k < N; k++) {
+            readers[k] = 0;
+        }
+    }
+
+    // read returns the published value
+    Reader read() const {
+        for (;;) {
+            size_t k = current.load();
+            readers[k].fetch_add(1);
+            // Once marked, the slot is safe to read as long as it was still the published one
+            if (current.load() == k) {
+                return Reader(this, k);
+            }
+            readers[k].fetch_sub(1, std::memory_order_release);
+        }
+    }
+
+    /* acquire returns a slot for the writer to fill, it still holds the value it had when it was last published.
+       It returns NULL when readers hold every other slot */
+    T* acquire() {
+        size_t published = current.load(std::memory_order_relaxed);
+        for (size_t k = 0; k < N; k++) {
+            if (k != published && readers[k].load() == 0) {
+                return &slots[k];
+            }
+        }
+        return NULL;
+    }
+
+    // publish makes the slot returned by acquire the published value
+    void publish(T* slot) {
+        current.store(slot - slots);
+    }
+
+private:
+    T slots[N];
+    std::atomic<size_t> current;
+    mutable std::atomic<int> readers[N];
+};
+
+#endif
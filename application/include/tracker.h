@@ -0,0 +1,122 @@
+/*
+* Copyright (c) 2018 Intel Corporation.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef TRACKER_H_INCLUDED
+#define TRACKER_H_INCLUDED
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+// Centroid is the center point of detected car rectangle
+struct Centroid {
+    int id;
+    cv::Point p;
+    int gone_count;
+};
+
+// ParkingInfo contains information about available parking spaces
+struct ParkingInfo
+{
+    int total_in;
+    int total_out;
+    // centroids lists the visible cars in no particular order
+    std::vector<Centroid> centroids;
+};
+
+// CountEvent is a car counted in or out of the parking
+struct CountEvent {
+    int id;
+    // direction is 1 for a car going in and -1 for a car going out
+    int direction;
+};
+
+/* TrackSet stores the tracked cars as a structure of arrays, slot i of every array belongs to the same car.
+   Removing a car moves the last one into its slot, so the arrays stay dense and every pass of the tracker
+   walks contiguous memory. Ids are handed out once and stay with the car for its whole life.
+   The trajectory of a car is kept as a running sum of its positions along the entrance axis, which is all the
+   direction needs, and a ring of its last history points, which is all the velocity needs. So the cost and
+   memory of a car stay the same no matter how long it stays in view */
+struct TrackSet {
+    // history is the number of recent trajectory points kept for every car
+    static const int history = 16;
+
+    // id of the car
+    std::vector<int> id;
+    // p is the last centroid position of the car
+    std::vector<cv::Point> p;
+    // gone_count is the number of frames the car has been missing for
+    std::vector<int> gone_count;
+    // direction of the car movement along the entrance axis
+    std::vector<int> direction;
+    std::vector<unsigned char> counted;
+    // gone is set once the car has been missing for more than max_frames_gone frames
+    std::vector<unsigned char> gone;
+    // axis_sum is the sum of the trajectory points along the entrance axis
+    std::vector<long long> axis_sum;
+    // samples is the number of trajectory points of the car
+    std::vector<int> samples;
+    // recent holds history points per car, trajectory point k of the car in slot i is at i*history + k%history
+    std::vector<cv::Point> recent;
+
+    size_t size() const { return id.size(); }
+    size_t add(int car_id, cv::Point pos);
+    void remove(size_t slot);
+    void clear();
+};
+
+/* CounterContext holds the complete car counting state of a single video stream. Every stream
+   owns its own context, so any number of them can be updated side by side from different threads */
+struct CounterContext {
+    // Tracker parameters
+    std::string entrance;
+    int max_distance;
+    int max_frames_gone;
+    // side is the entrance edge resolved once from the entrance parameter: 't', 'b', 'l', 'r' or 0
+    char side;
+
+    // tracks holds the tracked cars
+    TrackSet tracks;
+    // id is a counter used to generate ids for tracked cars
+    int id;
+
+    // Total cars in and out of the parking
+    int total_in;
+    int total_out;
+    // events lists the cars counted by the last updateCarTotals call
+    std::vector<CountEvent> events;
+};
+
+void initCounterContext(CounterContext& ctx, const std::string& entrance, int max_distance, int max_frames_gone);
+void updateCentroids(CounterContext& ctx, const std::vector<cv::Point>& points);
+void centroids2Cars(CounterContext& ctx);
+cv::Point2f carVelocity(const TrackSet& tracks, size_t slot, int frames);
+std::vector<cv::Point> predictCentroids(const CounterContext& ctx, int history);
+double maxCarSpeed(const CounterContext& ctx, int history);
+void updateCarTotals(CounterContext& ctx);
+void counterInfo(const CounterContext& ctx, ParkingInfo& info);
+cv::Rect entranceBand(cv::Size size, const std::string& entrance, double band);
+
+#endif
@@ -0,0 +1,251 @@
+/*
+* Copyright (c) 2018 Intel Corporation.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <algorithm>
+#include <limits>
+#include <math.h>
+
+#include "association.h"
+
+using namespace std;
+using namespace cv;
+
+// Cost of a pair outside of the gate, large enough for any gated pair to be preferred
+static const double forbidden = 1e12;
+
+// cellOf returns the grid cell coordinate of a point coordinate
+static int cellOf(int v, int cell) {
+    return v >= 0 ? v / cell : (v - cell + 1) / cell;
+}
+
+// key packs the cell coordinates into the cell key, they are made unsigned first as a negative value can't be shifted
+uint64_t CentroidGrid::key(int cx, int cy) const {
+    return ((uint64_t)(uint32_t)cx << 32) | (uint32_t)cy;
+}
+
+void CentroidGrid::build(const vector<Point>& points, int cell) {
+    this->cell = max(1, cell);
+    this->points = &points;
+    cells.clear();
+    for (size_t i = 0; i < points.size(); i++) {
+        cells.push_back(make_pair(key(cellOf(points[i].x, this->cell), cellOf(points[i].y, this->cell)), (int)i));
+    }
+    sort(cells.begin(), cells.end());
+}
+
+// inGate checks whether the points a and b are within the gate
+static bool inGate(Point a, Point b, const AssociationGate& gate, double& dist) {
+    int dx = a.x - b.x;
+    int dy = a.y - b.y;
+    if (abs(dx) > gate.max_dx || abs(dy) > gate.max_dy) {
+        return false;
+    }
+    dist = sqrt((double)dx*dx + (double)dy*dy);
+    return dist <= gate.max_distance;
+}
+
+void CentroidGrid::query(Point p, const AssociationGate& gate, vector<int>& out) const {
+    int cx = cellOf(p.x, cell);
+    int cy = cellOf(p.y, cell);
+    for (int x = cx - 1; x <= cx + 1; x++) {
+        for (int y = cy - 1; y <= cy + 1; y++) {
+            vector<pair<uint64_t, int> >::const_iterator it =
+                lower_bound(cells.begin(), cells.end(), make_pair(key(x, y), numeric_limits<int>::min()));
+            for (; it != cells.end() && it->first == key(x, y); ++it) {
+                double dist;
+                if (inGate(p, (*points)[it->second], gate, dist)) {
+                    out.push_back(it->second);
+                }
+            }
+        }
+    }
+}
+
+/* hungarian solves the assignment problem of the rows x cols cost matrix, rows <= cols, and returns
+   the column assigned to every row */
+static vector<int> hungarian(const vector<double>& cost, int rows, int cols) {
+    const double inf = numeric_limits<double>::infinity();
+    vector<double> u(rows + 1, 0), v(cols + 1, 0), minv(cols + 1);
+    vector<int> p(cols + 1, 0), way(cols + 1, 0);
+    vector<char> used(cols + 1);
+
+    for (int i = 1; i <= rows; i++) {
+        p[0] = i;
+        int j0 = 0;
+        fill(minv.begin(), minv.end(), inf);
+        fill(used.begin(), used.end(), 0);
+        do {
+            used[j0] = 1;
+            int i0 = p[j0];
+            int j1 = 0;
+            double delta = inf;
+            for (int j = 1; j <= cols; j++) {
+                if (used[j]) {
+                    continue;
+                }
+                double cur = cost[(i0 - 1) * cols + (j - 1)] - u[i0] - v[j];
+                if (cur < minv[j]) {
+                    minv[j] = cur;
+                    way[j] = j0;
+                }
+                if (minv[j] < delta) {
+                    delta = minv[j];
+                    j1 = j;
+                }
+            }
+            for (int j = 0; j <= cols; j++) {
+                if (used[j]) {
+                    u[p[j]] += delta;
+                    v[j] -= delta;
+                } else {
+                    minv[j] -= delta;
+                }
+            }
+            j0 = j1;
+        } while (p[j0] != 0);
+
+        do {
+            int j1 = way[j0];
+            p[j0] = p[j1];
+            j0 = j1;
+        } while (j0 != 0);
+    }
+
+    vector<int> assigned(rows, -1);
+    for (int j = 1; j <= cols; j++) {
+        if (p[j] != 0) {
+            assigned[p[j] - 1] = j - 1;
+        }
+    }
+    return assigned;
+}
+
+// findRoot returns the root of the union-find set of node i
+static int findRoot(vector<int>& parent, int i) {
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+// GatedPair is a detected point and a tracked point within the gate of each other
+struct GatedPair {
+    int point;
+    int tracked;
+    double dist;
+    int component;
+};
+
+static bool byComponent(const GatedPair& a, const GatedPair& b) {
+    return a.component < b.component;
+}
+
+vector<int> assignPoints(const vector<Point>& points, const vector<Point>& tracked, const AssociationGate& gate) {
+    vector<int> assigned(points.size(), -1);
+    if (points.empty() || tracked.empty()) {
+        return assigned;
+    }
+
+    CentroidGrid grid;
+    grid.build(tracked, gate.max_distance);
+
+    // Find all the gated pairs and join the points of every pair into one component
+    int n = (int)points.size();
+    vector<int> parent(n + tracked.size());
+    for (size_t i = 0; i < parent.size(); i++) {
+        parent[i] = (int)i;
+    }
+    vector<GatedPair> pairs;
+    vector<int> candidates;
+    for (int i = 0; i < n; i++) {
+        candidates.clear();
+        grid.query(points[i], gate, candidates);
+        for (size_t c = 0; c < candidates.size(); c++) {
+            GatedPair pair;
+            pair.point = i;
+            pair.tracked = candidates[c];
+            inGate(points[i], tracked[pair.tracked], gate, pair.dist);
+            pairs.push_back(pair);
+            parent[findRoot(parent, i)] = findRoot(parent, n + pair.tracked);
+        }
+    }
+    for (size_t k = 0; k < pairs.size(); k++) {
+        pairs[k].component = findRoot(parent, pairs[k].point);
+    }
+    sort(pairs.begin(), pairs.end(), byComponent);
+
+    // Solve every component on its own, they usually hold just a few cars each
+    vector<int> rows, cols, row_of(n, -1), col_of(tracked.size(), -1);
+    vector<double> cost;
+    for (size_t begin = 0; begin < pairs.size(); ) {
+        size_t end = begin;
+        while (end < pairs.size() && pairs[end].component == pairs[begin].component) {
+            end++;
+        }
+
+        rows.clear();
+        cols.clear();
+        for (size_t k = begin; k < end; k++) {
+            if (row_of[pairs[k].point] < 0) {
+                row_of[pairs[k].point] = (int)rows.size();
+                rows.push_back(pairs[k].point);
+            }
+            if (col_of[pairs[k].tracked] < 0) {
+                col_of[pairs[k].tracked] = (int)cols.size();
+                cols.push_back(pairs[k].tracked);
+            }
+        }
+
+        // The Hungarian algorithm needs no more rows than columns, so transpose when there are more points
+        bool transpose = rows.size() > cols.size();
+        int r = (int)(transpose ? cols.size() : rows.size());
+        int c = (int)(transpose ? rows.size() : cols.size());
+        cost.assign(r * c, forbidden);
+        for (size_t k = begin; k < end; k++) {
+            int pr = row_of[pairs[k].point];
+            int pc = col_of[pairs[k].tracked];
+            cost[transpose ? pc * c + pr : pr * c + pc] = pairs[k].dist;
+        }
+
+        vector<int> solution = hungarian(cost, r, c);
+        for (int i = 0; i < r; i++) {
+            int j = solution[i];
+            if (j < 0 || cost[i * c + j] >= forbidden) {
+                continue;
+            }
+            if (transpose) {
+                assigned[rows[j]] = cols[i];
+            } else {
+                assigned[rows[i]] = cols[j];
+            }
+        }
+
+        for (size_t k = begin; k < end; k++) {
+            row_of[pairs[k].point] = -1;
+            col_of[pairs[k].tracked] = -1;
+        }
+        begin = end;
+    }
+    return assigned;
+}
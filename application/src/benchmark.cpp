@@ -0,0 +1,570 @@
+/*
+* Copyright (c) 2018 Intel Corporation.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <iostream>
+#include <thread>
+#include <queue>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <time.h>
+#include <math.h>
+#include <float.h>
+
+// OpenCV includes
+#include <opencv2/core.hpp>
+#include <opencv2/dnn.hpp>
+
+#include "ring.h"
+#include "bounded_queue.h"
+#include "tracker.h"
+#include "association.h"
+#include "preprocess.h"
+
+using namespace std;
+using namespace cv;
+
+/* This file contains the microbenchmarks of the application building blocks.
+   Run ./benchmark to run all of them or ./benchmark <name> to run a single one */
+
+// threadCpuSeconds returns the CPU time consumed by the calling thread
+static double threadCpuSeconds() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// LockedQueue is the mutex guarded queue<Mat> the frame pipeline used before SpscRing
+struct LockedQueue {
+    queue<Mat> q;
+    mutex m;
+
+    bool push(const Mat& img) {
+        lock_guard<mutex> lock(m);
+        if (q.size() >= 300) {
+            return false;
+        }
+        q.push(img);
+        return true;
+    }
+
+    bool pop(Mat& img) {
+        lock_guard<mutex> lock(m);
+        if (q.empty()) {
+            return false;
+        }
+        img = q.front();
+        q.pop();
+        return true;
+    }
+};
+
+/* BoundedFrames is the frame queue of the pipeline: a BoundedQueue of 24 frames, the default of -queue_frames, with
+   the block policy the pipeline uses for video files. A dropping policy would lose frames the consumer waits for */
+struct BoundedFrames {
+    BoundedQueue<Mat> q;
+
+    BoundedFrames() {
+        q.configure(24, 0, BLOCK);
+    }
+
+    bool push(const Mat& img) {
+        size_t evicted;
+        return q.push(img, img.total() * img.elemSize(), evicted);
+    }
+
+    bool pop(Mat& img) {
+        return q.pop(img);
+    }
+};
+
+// SpinWait is the wait policy of the old frameRunner loop, which polled the queue without pausing
+struct SpinWait {
+    void pause() {}
+    void reset() {}
+};
+
+/* transfer pushes count frame headers from a producer thread to the calling thread and returns
+   the mean cost of one enqueue and dequeue pair in nanoseconds */
+template <typename Q, typename W>
+static double transfer(Q& q, long count) {
+    Mat frame(384, 672, CV_8UC3);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    thread producer([&q, &frame, count]() {
+        W wait;
+        for (long i = 0; i < count; i++) {
+            while (!q.push(frame)) {
+                wait.pause();
+            }
+            wait.reset();
+        }
+    });
+
+    W wait;
+    Mat next;
+    for (long i = 0; i < count; ) {
+        if (q.pop(next)) {
+            wait.reset();
+            i++;
+        } else {
+            wait.pause();
+        }
+    }
+    producer.join();
+    chrono::duration<double, nano> elapsed = chrono::steady_clock::now() - start;
+    return elapsed.count() / count;
+}
+
+// idleCpu polls an empty queue for the given time and returns the share of a core it consumed
+template <typename Q, typename W>
+static double idleCpu(Q& q, double seconds) {
+    W wait;
+    Mat next;
+    double cpu = threadCpuSeconds();
+    chrono::steady_clock::time_point end = chrono::steady_clock::now() + chrono::milliseconds((long)(seconds * 1000));
+    while (chrono::steady_clock::now() < end) {
+        if (!q.pop(next)) {
+            wait.pause();
+        }
+    }
+    return (threadCpuSeconds() - cpu) / seconds;
+}
+
+/* benchQueue compares the queues between the pipeline stages against the mutex guarded queue they replaced: the
+   BoundedQueue of the frames from the capture to the inference, and the SpscRing of the detections from the
+   inference to the tracker */
+static bool benchQueue() {
+    const long count = 1000000;
+    const double idle = 1.0;
+
+    LockedQueue locked;
+    BoundedFrames frames;
+    SpscRing<Mat> ring(300);
+
+    cout << "queue: enqueue+dequeue of " << count << " frames, idle CPU over " << idle << " s" << endl;
+    cout << format("  %-28s %10.1f ns/frame %8.1f %% core idle",
+                   "queue<Mat> + mutex, spin", transfer<LockedQueue, SpinWait>(locked, count),
+                   100 * idleCpu<LockedQueue, SpinWait>(locked, idle)) << endl;
+    cout << format("  %-28s %10.1f ns/frame %8.1f %% core idle",
+                   "BoundedQueue block, backoff", transfer<BoundedFrames, Backoff>(frames, count),
+                   100 * idleCpu<BoundedFrames, Backoff>(frames, idle)) << endl;
+    cout << format("  %-28s %10.1f ns/frame %8.1f %% core idle",
+                   "SpscRing, backoff", transfer<SpscRing<Mat>, Backoff>(ring, count),
+                   100 * idleCpu<SpscRing<Mat>, Backoff>(ring, idle)) << endl;
+    return true;
+}
+
+/* closestCentroid is the point by point association the tracker used before assignPoints: it took the
+   centroids map by value and scanned all of it for every detected point */
+static pair<int, double> closestCentroid(const Point p, const map<int, Centroid> centroids) {
+    int id = 0;
+    double dist = DBL_MAX;
+    for (map<int, Centroid>::const_iterator it = centroids.begin(); it != centroids.end(); ++it) {
+        Point _p = it->second.p;
+        if (_p.x < (p.x-50) || _p.x > (p.x+50)) {
+            continue;
+        }
+        double dx = double(p.x - _p.x);
+        double dy = double(p.y - _p.y);
+        double _dist = sqrt(dx*dx + dy*dy);
+        if (_dist < dist) {
+            dist = _dist;
+            id = it->second.id;
+        }
+    }
+    return make_pair(id, dist);
+}
+
+/* carField returns count car positions spread over an area which grows with the number of cars,
+   like the lanes of a wide gate or a busy lot, shifted down by the frame number */
+static vector<Point> carField(int count, int frame) {
+    int lanes = max(1, (int)sqrt((double)count));
+    vector<Point> points;
+    for (int i = 0; i < count; i++) {
+        // Pseudo random jitter keeps the cars off a regular lattice
+        int jitter = (i * 7919) % 41 - 20;
+        points.push_back(Point((i % lanes) * 120 + jitter, (i / lanes) * 150 + jitter + frame * 4));
+    }
+    return points;
+}
+
+/* MapCounter is the tracker state before TrackSet: a map of centroids and a map of cars keyed by id,
+   with the entrance string compared for every car in every pass */
+struct MapCar {
+    vector<Point> traject;
+    bool counted;
+    bool gone;
+    int direction;
+};
+
+struct MapCounter {
+    string entrance;
+    int max_distance;
+    int max_frames_gone;
+    map<int, MapCar> tracked_cars;
+    map<int, Centroid> centroids;
+    int id;
+    int total_in;
+    int total_out;
+};
+
+static void mapAddCentroid(MapCounter& ctx, Point p) {
+    Centroid c = {ctx.id, p, 0};
+    ctx.centroids[c.id] = c;
+    ctx.id++;
+}
+
+static void mapUpdateCentroids(MapCounter& ctx, const vector<Point>& points) {
+    vector<Point> tracked;
+    vector<int> ids;
+    for (map<int, Centroid>::const_iterator it = ctx.centroids.begin(); it != ctx.centroids.end(); ++it) {
+        tracked.push_back(it->second.p);
+        ids.push_back(it->second.id);
+    }
+    AssociationGate gate = {ctx.max_distance, 50, ctx.max_distance};
+    vector<int> assigned(points.size(), -1);
+    if (!points.empty() && !tracked.empty()) {
+        assigned = assignPoints(points, tracked, gate);
+    }
+    set<int> checked;
+    for (size_t i = 0; i < points.size(); i++) {
+        if (assigned[i] >= 0) {
+            Centroid& c = ctx.centroids[ids[assigned[i]]];
+            c.p = points[i];
+            c.gone_count = 0;
+            checked.insert(c.id);
+        }
+    }
+    for (map<int, Centroid>::iterator it = ctx.centroids.begin(); it != ctx.centroids.end(); ) {
+        if (checked.find(it->first) == checked.end() && ++it->second.gone_count > ctx.max_frames_gone) {
+            map<int, MapCar>::iterator car = ctx.tracked_cars.find(it->first);
+            if (car != ctx.tracked_cars.end()) {
+                car->second.gone = true;
+            }
+            it = ctx.centroids.erase(it);
+            continue;
+        }
+        ++it;
+    }
+    for (size_t i = 0; i < points.size(); i++) {
+        if (assigned[i] < 0) {
+            mapAddCentroid(ctx, points[i]);
+        }
+    }
+}
+
+static int mapAxis(Point p, const string& entrance) {
+    if (entrance.compare("l") == 0 || entrance.compare("r") == 0) {
+        return p.x;
+    }
+    if (entrance.compare("b") == 0 || entrance.compare("t") == 0) {
+        return p.y;
+    }
+    return 0;
+}
+
+static void mapCentroids2Cars(MapCounter& ctx) {
+    for (map<int, Centroid>::iterator it = ctx.centroids.begin(); it != ctx.centroids.end(); ++it) {
+        Point p = it->second.p;
+        map<int, MapCar>::iterator tracked = ctx.tracked_cars.find(it->first);
+        if (tracked == ctx.tracked_cars.end()) {
+            MapCar car;
+            car.traject.push_back(p);
+            car.counted = false;
+            car.gone = false;
+            car.direction = 0;
+            ctx.tracked_cars[it->first] = car;
+            continue;
+        }
+        MapCar& car = tracked->second;
+        int movement = 0;
+        for (size_t i = 0; i < car.traject.size(); i++) {
+            movement += mapAxis(car.traject[i], ctx.entrance);
+        }
+        movement = movement / (int)car.traject.size();
+        car.traject.push_back(p);
+        car.direction = mapAxis(p, ctx.entrance) - movement;
+    }
+}
+
+static void mapUpdateCarTotals(MapCounter& ctx) {
+    const string& entrance = ctx.entrance;
+    for (map<int, MapCar>::iterator it = ctx.tracked_cars.begin(); it != ctx.tracked_cars.end(); ) {
+        MapCar& car = it->second;
+        bool erase = car.counted && car.gone;
+        if (!car.counted) {
+            bool up = entrance.compare("t") == 0 || entrance.compare("l") == 0;
+            bool down = entrance.compare("b") == 0 || entrance.compare("r") == 0;
+            if (!car.gone && ((up && car.direction > 0) || (down && car.direction < 0))) {
+                ctx.total_in++;
+                car.counted = true;
+            }
+            if (car.gone && ((up && car.direction < 0) || (down && car.direction > 0))) {
+                ctx.total_out++;
+                erase = true;
+            }
+        }
+        if (erase) {
+            it = ctx.tracked_cars.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+// centroidMap returns the visible cars of the tracker as the map closestCentroid scans
+static map<int, Centroid> centroidMap(const CounterContext& ctx) {
+    ParkingInfo info;
+    counterInfo(ctx, info);
+    map<int, Centroid> centroids;
+    for (const Centroid& c: info.centroids) {
+        centroids[c.id] = c;
+    }
+    return centroids;
+}
+
+// benchTracker measures the per-frame cost of associating detections with 10 to 1000 tracked cars
+static bool benchTracker() {
+    const int frames = 20;
+    const int counts[] = {10, 100, 1000};
+
+    cout << "tracker: association cost per frame" << endl;
+    for (int count: counts) {
+        CounterContext ctx;
+        initCounterContext(ctx, "b", 200, 25);
+        updateCentroids(ctx, carField(count, 0));
+        map<int, Centroid> centroids = centroidMap(ctx);
+        vector<Point> tracked = carField(count, 0);
+        AssociationGate gate = {200, 50, 200};
+
+        double greedy = 0;
+        double global = 0;
+        double update = 0;
+        for (int f = 1; f <= frames; f++) {
+            vector<Point> points = carField(count, f);
+
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            for (const Point& p: points) {
+                closestCentroid(p, centroids);
+            }
+            chrono::steady_clock::time_point t1 = chrono::steady_clock::now();
+            assignPoints(points, tracked, gate);
+            chrono::steady_clock::time_point t2 = chrono::steady_clock::now();
+            updateCentroids(ctx, points);
+            centroids2Cars(ctx);
+            chrono::steady_clock::time_point t3 = chrono::steady_clock::now();
+
+            greedy += chrono::duration<double, micro>(t1 - start).count();
+            global += chrono::duration<double, micro>(t2 - t1).count();
+            update += chrono::duration<double, micro>(t3 - t2).count();
+            tracked = points;
+            centroids = centroidMap(ctx);
+        }
+        cout << format("  %5d cars: closest centroid scan %10.1f us  grid + Hungarian %8.1f us  full update %8.1f us",
+                       count, greedy / frames, global / frames, update / frames) << endl;
+    }
+
+    /* A tenth of the cars drops out of the detections for 10 frames in turn, so cars keep going and coming
+       back as new ones. Both trackers get the same detections and must agree on the counts */
+    const int drive = 200;
+    bool agree = true;
+    cout << "tracker: tracking cost per frame over " << drive << " frames, map storage vs TrackSet" << endl;
+    for (int count: counts) {
+        MapCounter before = {"b", 200, 5, map<int, MapCar>(), map<int, Centroid>(), 0, 0, 0};
+        CounterContext after;
+        initCounterContext(after, "b", 200, 5);
+
+        double map_time = 0;
+        double set_time = 0;
+        for (int f = 0; f < drive; f++) {
+            vector<Point> field = carField(count, f % 50);
+            vector<Point> points;
+            for (size_t i = 0; i < field.size(); i++) {
+                if ((i + f / 10) % 10 != 0) {
+                    points.push_back(field[i]);
+                }
+            }
+
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            mapUpdateCentroids(before, points);
+            mapCentroids2Cars(before);
+            mapUpdateCarTotals(before);
+            chrono::steady_clock::time_point t1 = chrono::steady_clock::now();
+            updateCentroids(after, points);
+            centroids2Cars(after);
+            updateCarTotals(after);
+            chrono::steady_clock::time_point t2 = chrono::steady_clock::now();
+
+            map_time += chrono::duration<double, micro>(t1 - start).count();
+            set_time += chrono::duration<double, micro>(t2 - t1).count();
+        }
+        cout << format("  %5d cars: map storage %10.1f us  TrackSet %10.1f us  counts %d/%d vs %d/%d",
+                       count, map_time / drive, set_time / drive,
+                       before.total_in, before.total_out, after.total_in, after.total_out) << endl;
+        if (before.total_in != after.total_in || before.total_out != after.total_out) {
+            cerr << "ERROR! TrackSet counts differ from the map based tracker for " << count << " cars" << endl;
+            agree = false;
+        }
+    }
+
+    /* Cars waiting at the gate stay in view for minutes. The full trajectory of the map based tracker makes
+       every frame dearer the longer they wait, the running sums of TrackSet don't */
+    const int parked = 100;
+    const int checkpoints[] = {100, 1000, 5000};
+    cout << "tracker: tracking cost per frame of " << parked << " parked cars, map storage vs TrackSet" << endl;
+    MapCounter before = {"b", 200, 5, map<int, MapCar>(), map<int, Centroid>(), 0, 0, 0};
+    CounterContext after;
+    initCounterContext(after, "b", 200, 5);
+    vector<Point> points = carField(parked, 0);
+    int frame = 0;
+    for (int checkpoint: checkpoints) {
+        // The trackers run one after the other, so the long trajectories of one don't evict the other from cache
+        chrono::steady_clock::time_point timed = chrono::steady_clock::now();
+        for (int f = frame; f < checkpoint; f++) {
+            // Only the last 100 frames before the checkpoint are timed
+            if (f == checkpoint - 100) {
+                timed = chrono::steady_clock::now();
+            }
+            mapUpdateCentroids(before, points);
+            mapCentroids2Cars(before);
+            mapUpdateCarTotals(before);
+        }
+        double map_time = chrono::duration<double, micro>(chrono::steady_clock::now() - timed).count();
+
+        timed = chrono::steady_clock::now();
+        for (int f = frame; f < checkpoint; f++) {
+            if (f == checkpoint - 100) {
+                timed = chrono::steady_clock::now();
+            }
+            updateCentroids(after, points);
+            centroids2Cars(after);
+            updateCarTotals(after);
+        }
+        double set_time = chrono::duration<double, micro>(chrono::steady_clock::now() - timed).count();
+
+        frame = checkpoint;
+        cout << format("  frame %5d: map storage %10.1f us  TrackSet %10.1f us",
+                       checkpoint, map_time / 100, set_time / 100) << endl;
+    }
+    return agree;
+}
+
+// timeKernel returns the mean time of one call of kernel in microseconds, after a warm-up call
+template <typename F>
+static double timeKernel(F kernel, int runs) {
+    kernel();
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int i = 0; i < runs; i++) {
+        kernel();
+    }
+    return chrono::duration<double, micro>(chrono::steady_clock::now() - start).count() / runs;
+}
+
+// countDiffering returns the number of values of the blob item out which differ from the blob reference
+static size_t countDiffering(const Mat& reference, const float* out) {
+    size_t differ = 0;
+    const float* ref = reference.ptr<float>();
+    for (size_t i = 0; i < reference.total(); i++) {
+        differ += ref[i] != out[i];
+    }
+    return differ;
+}
+
+/* benchPreprocess times the fused preprocessing kernel against blobFromImage on a single thread, for every variant
+   of its vertical pass the processor can run. It fails when a variant gives a single value which differs from
+   blobFromImage, for the whole frame or for a crop of it */
+static bool benchPreprocess() {
+    const int runs = 50;
+    const Size net_size(672, 384);
+    const Size frame_sizes[] = {Size(1920, 1080), Size(1280, 720), Size(640, 480), Size(300, 200)};
+    const BlendKernel kernels[] = {BLEND_SCALAR, BLEND_SSE2, BLEND_AVX2};
+    const char* kernel_names[] = {"scalar", "SSE2", "AVX2"};
+
+    int threads = getNumThreads();
+    setNumThreads(1);
+    bool equal = true;
+    cout << "preprocess: frame to " << net_size.width << "x" << net_size.height << " network input, one thread" << endl;
+    for (const Size& frame_size: frame_sizes) {
+        Mat frame(frame_size, CV_8UC3);
+        randu(frame, Scalar::all(0), Scalar::all(256));
+        // A crop is not continuous in memory, like the region of interest of a frame
+        Mat crop = frame(Rect(frame_size.width / 8, frame_size.height / 8, frame_size.width / 2 + 1,
+                              frame_size.height / 2 + 1));
+        Mat reference, crop_reference;
+        double opencv = timeKernel([&]() { dnn::blobFromImage(frame, reference, 1.0, net_size); }, runs);
+        dnn::blobFromImage(crop, crop_reference, 1.0, net_size);
+        cout << format("  %4dx%-4d blobFromImage %8.1f us", frame_size.width, frame_size.height, opencv);
+
+        vector<float> out(reference.total());
+        for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+            if (!BlobResizer::supported(kernels[k])) {
+                cout << "  " << kernel_names[k] << " not supported";
+                continue;
+            }
+            BlobResizer resizer(kernels[k]);
+            double fused = timeKernel([&]() { resizer.resize(frame, net_size, out.data()); }, runs);
+            size_t differ = countDiffering(reference, out.data());
+            resizer.resize(crop, net_size, out.data());
+            differ += countDiffering(crop_reference, out.data());
+            cout << format("  %s %8.1f us", kernel_names[k], fused);
+            if (differ > 0) {
+                cout << " (" << differ << " values differ)";
+                equal = false;
+            }
+        }
+        cout << endl;
+    }
+    setNumThreads(threads);
+    if (!equal) {
+        cerr << "ERROR! The fused preprocessing differs from blobFromImage" << endl;
+    }
+    return equal;
+}
+
+// Benchmark is a named benchmark, run returns false when a check of the benchmark failed
+struct Benchmark {
+    const char* name;
+    bool (*run)();
+};
+
+static const Benchmark benchmarks[] = {
+    {"queue", benchQueue},
+    {"tracker", benchTracker},
+    {"preprocess", benchPreprocess},
+};
+
+int main(int argc, char** argv)
+{
+    string only = argc > 1 ? argv[1] : "";
+    bool passed = true;
+    for (const Benchmark& b: benchmarks) {
+        if (only.empty() || only == b.name) {
+            passed = b.run() && passed;
+        }
+    }
+    return passed ? 0 : 1;
+}
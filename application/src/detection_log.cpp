@@ -0,0 +1,179 @@
+/*
+* Copyright (c) 2018 Intel Corporation.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <iostream>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "detection_log.h"
+
+using namespace std;
+using namespace cv;
+
+static const char log_magic[4] = {'P', 'L', 'D', 'L'};
+static const uint32_t log_version = 1;
+
+DetectionWriter::DetectionWriter() : file(NULL), header_written(false) {}
+
+DetectionWriter::~DetectionWriter() {
+    close();
+}
+
+bool DetectionWriter::open(const string& path) {
+    close();
+    file = fopen(path.c_str(), "wb");
+    if (file == NULL) {
+        return false;
+    }
+    // Frames are written one by one from the tracking thread, buffer them so they don't turn into small writes
+    setvbuf(file, NULL, _IOFBF, 1 << 20);
+    header_written = false;
+    return true;
+}
+
+void DetectionWriter::write(uint32_t frame, int mode, int64_t timestamp, const float* rows, size_t count,
+                            size_t row_size, Size size, Rect roi) {
+    if (file == NULL) {
+        return;
+    }
+    bool ok = true;
+    if (!header_written) {
+        DetectionLogHeader head;
+        memset(&head, 0, sizeof(head));
+        memcpy(head.magic, log_magic, sizeof(head.magic));
+        head.version = log_version;
+        head.width = size.width;
+        head.height = size.height;
+        head.roi_x = roi.x;
+        head.roi_y = roi.y;
+        head.roi_width = roi.width;
+        head.roi_height = roi.height;
+        head.row_size = (uint32_t)row_size;
+        ok = fwrite(&head, sizeof(head), 1, file) == 1;
+        header_written = true;
+    }
+
+    DetectionRecord record;
+    memset(&record, 0, sizeof(record));
+    record.frame = frame;
+    record.mode = (uint32_t)mode;
+    record.rows = (uint32_t)count;
+    record.timestamp = timestamp;
+    ok = ok && fwrite(&record, sizeof(record), 1, file) == 1;
+    if (count > 0) {
+        ok = ok && fwrite(rows, sizeof(float) * row_size, count, file) == count;
+    }
+    if (!ok) {
+        cerr << "ERROR! Unable to write the detection log, recording stopped\n";
+        close();
+    }
+}
+
+void DetectionWriter::close() {
+    if (file != NULL) {
+        fclose(file);
+        file = NULL;
+    }
+}
+
+bool DetectionWriter::isOpen() const {
+    return file != NULL;
+}
+
+DetectionReader::DetectionReader() : data(NULL), length(0), offset(0) {
+    memset(&head, 0, sizeof(head));
+}
+
+DetectionReader::~DetectionReader() {
+    close();
+}
+
+bool DetectionReader::open(const string& path) {
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(DetectionLogHeader)) {
+        ::close(fd);
+        return false;
+    }
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping stays valid after the file is closed
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    // The log is read front to back once
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    data = (const char*)map;
+    length = st.st_size;
+
+    memcpy(&head, data, sizeof(head));
+    if (memcmp(head.magic, log_magic, sizeof(head.magic)) != 0 || head.version != log_version || head.row_size == 0) {
+        close();
+        return false;
+    }
+    offset = sizeof(head);
+    return true;
+}
+
+const DetectionLogHeader& DetectionReader::header() const {
+    return head;
+}
+
+Size DetectionReader::size() const {
+    return Size(head.width, head.height);
+}
+
+Rect DetectionReader::roi() const {
+    return Rect(head.roi_x, head.roi_y, head.roi_width, head.roi_height);
+}
+
+bool DetectionReader::next(DetectionRecord& record, const float*& rows) {
+    if (data == NULL || length - offset < sizeof(record)) {
+        return false;
+    }
+    memcpy(&record, data + offset, sizeof(record));
+    size_t bytes = (size_t)record.rows * head.row_size * sizeof(float);
+    if (length - offset - sizeof(record) < bytes) {
+        return false;
+    }
+    // Every field before the rows is a multiple of 4 bytes long, so the rows are aligned for float access
+    rows = (const float*)(data + offset + sizeof(record));
+    offset += sizeof(record) + bytes;
+    return true;
+}
+
+void DetectionReader::close() {
+    if (data != NULL) {
+        munmap((void*)data, length);
+        data = NULL;
+    }
+    length = 0;
+    offset = 0;
+}
@@ -0,0 +1,144 @@
+/*
+* Copyright (c) 2018 Intel Corporation.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <chrono>
+
+#include "detections.h"
+
+using namespace std;
+using namespace cv;
+
+/* decodeDetections returns the centroids of the cars among the count detection rows of a frame of the given size,
+   which pass the filter. The coordinates of the rows are relative to roi */
+vector<Point> decodeDetections(const float* data, size_t count, Size size, Rect roi, const DetectionFilter& filter) {
+    vector<Point> frame_centroids;
+    // Get detected cars and in and out counts
+    vector<Rect> frame_cars;
+    for (size_t i = 0; i < count * 7; i += 7) {
+        int label = (int)data[i + 1];
+        float confidence = data[i + 2];
+        if (label == 1 && confidence > filter.confidence) {
+            int left = roi.x + (int)(data[i + 3] * roi.width);
+            int top = roi.y + (int)(data[i + 4] * roi.height);
+            int right = roi.x + (int)(data[i + 5] * roi.width);
+            int bottom = roi.y + (int)(data[i + 6] * roi.height);
+            int width = right - left + 1;
+            int height = bottom - top + 1;
+            
+            // Check whether the detected object is going out of range of the frame  
+            if(bottom >= size.height) {
+                height = size.height - top;
+            }
+            frame_cars.push_back(Rect(left, top, width, height));
+        }
+    }
+
+    for(auto const& fc: frame_cars) {
+        // Make sure the car rect is completely inside the main Mat
+        if ((fc & Rect(0, 0, size.width, size.height)) != fc) {
+            continue;
+        }
+
+        // Detected car rectangle dimensions
+        int width = fc.width;
+        int height = fc.height;
+        // If detected rectangle is too small, skip it
+        if (width < filter.min_size || height < filter.min_size) {
+            continue;
+        }
+
+        /* Sometimes detected car rectangle stretches way over the actual car dimensions
+           so we clip the sizes of the rectangle to avoid skewing the centroid positions */
+        int w_clip = filter.clip_width;
+        if (width > w_clip) {
+            if ((fc.x + w_clip) < size.width) {
+                width = w_clip;
+            }
+        } 
+        else if ((fc.x + width) > size.width) {
+            width = size.width - fc.x;
+        }
+
+        int h_clip = filter.clip_height;
+        if (height > h_clip) {
+            if ((fc.y + h_clip) < size.height){
+                height = h_clip;
+            }
+        } 
+        else if ((fc.y + height) > size.height) {
+            height = size.height - fc.y;
+        }
+
+        // Calculate detected car centroid coordinates
+        int x = fc.x + static_cast<int>(width/2.0);
+        int y = fc.y + static_cast<int>(height/2.0);
+
+        // Append detected centroid
+        frame_centroids.push_back(Point(x,y));
+    }
+    return frame_centroids;
+}
+
+// elapsedUs returns the microseconds passed since start and moves start to now
+static long elapsedUs(chrono::steady_clock::time_point& start) {
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    long us = chrono::duration_cast<chrono::microseconds>(now - start).count();
+    start = now;
+    return us;
+}
+
+/* trackDetections updates the tracker with the next frame. For a detected frame rows holds its count detection rows,
+   relative to roi. stride is the detection stride, the velocity of the cars on predicted frames is estimated over it.
+   When timings is set, it receives the time spent on decoding, association and counting */
+void trackDetections(CounterContext& ctx, FrameMode mode, const float* rows, size_t count, Size size, Rect roi,
+                     const DetectionFilter& filter, int stride, TrackTimings* timings) {
+    chrono::steady_clock::time_point start;
+    if (timings != NULL) {
+        start = chrono::steady_clock::now();
+    }
+
+    vector<Point> frame_centroids;
+    if (mode == PREDICTED) {
+        // The frame skipped the detector, move the visible cars ahead with their recent velocity
+        frame_centroids = predictCentroids(ctx, stride);
+    } else if (mode == DETECTED) {
+        frame_centroids = decodeDetections(rows, count, size, roi, filter);
+    }
+    if (timings != NULL) {
+        timings->decode_us = elapsedUs(start);
+    }
+
+    // Update tracked centroids using the centroids detected in the frame
+    updateCentroids(ctx, frame_centroids);
+    if (timings != NULL) {
+        timings->associate_us = elapsedUs(start);
+    }
+
+    // Associate centroids with tracked cars
+    centroids2Cars(ctx);
+    // Update tracked cars total counters
+    updateCarTotals(ctx);
+    if (timings != NULL) {
+        timings->count_us = elapsedUs(start);
+    }
+}
@@ -0,0 +1,68 @@
+/*
+* Copyright (c) 2018 Intel Corporation.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "frame_pool.h"
+
+using namespace std;
+using namespace cv;
+
+FramePool::FramePool(size_t size) : buffers(size), next(0), allocs(0), reads(0) {}
+
+// isFree checks whether nobody but the pool references the buffer
+static bool isFree(Mat& buffer) {
+    return buffer.u == NULL || CV_XADD(&buffer.u->refcount, 0) == 1;
+}
+
+bool FramePool::read(VideoCapture& cap, Mat& frame) {
+    for (size_t n = 0; n < buffers.size(); n++) {
+        size_t i = (next + n) % buffers.size();
+        Mat& buffer = buffers[i];
+        if (!isFree(buffer)) {
+            continue;
+        }
+
+        // VideoCapture decodes straight into the buffer when it already has the frame size and type
+        uchar* data = buffer.data;
+        cap.read(buffer);
+        if (buffer.empty()) {
+            frame = Mat();
+            return true;
+        }
+        if (buffer.data != data) {
+            allocs++;
+        }
+        reads++;
+        next = (i + 1) % buffers.size();
+        frame = buffer;
+        return true;
+    }
+    return false;
+}
+
+long FramePool::allocations() const {
+    return allocs.load();
+}
+
+long FramePool::frames() const {
+    return reads.load();
+}
@@ -0,0 +1,248 @@
+/*
+* Copyright (c) 2018 Intel Corporation.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "journal.h"
+
+using namespace std;
+
+static const char journal_magic[4] = {'P', 'L', 'M', 'J'};
+static const uint32_t journal_version = 1;
+
+MessageJournal::MessageJournal() : data(NULL), length(0), count(0), next_offset(0) {}
+
+MessageJournal::~MessageJournal() {
+    close();
+}
+
+bool MessageJournal::open(const string& path, size_t capacity) {
+    close();
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        return false;
+    }
+
+    // An existing journal keeps its messages, so it is never shrunk
+    JournalHeader head;
+    memset(&head, 0, sizeof(head));
+    bool existing = (size_t)st.st_size >= sizeof(head) && pread(fd, &head, sizeof(head), 0) == (ssize_t)sizeof(head) &&
+                    memcmp(head.magic, journal_magic, sizeof(head.magic)) == 0 && head.version == journal_version;
+    size_t size = max(capacity, existing ? (size_t)st.st_size : sizeof(head));
+    if ((size_t)st.st_size != size && ftruncate(fd, size) != 0) {
+        ::close(fd);
+        return false;
+    }
+    void* map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    // The mapping stays valid after the file is closed
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    data = (char*)map;
+    length = size;
+
+    JournalHeader* h = header();
+    if (!existing || h->read_offset < sizeof(JournalHeader) || h->read_offset > h->write_offset ||
+        h->write_offset > length) {
+        memset(h, 0, sizeof(JournalHeader));
+        memcpy(h->magic, journal_magic, sizeof(h->magic));
+        h->version = journal_version;
+        h->read_offset = sizeof(JournalHeader);
+        h->write_offset = sizeof(JournalHeader);
+    }
+    h->capacity = length;
+    scan();
+    return true;
+}
+
+void MessageJournal::close() {
+    if (data != NULL) {
+        munmap(data, length);
+        data = NULL;
+    }
+    length = 0;
+    count = 0;
+    next_offset = 0;
+    taken.clear();
+    last_coalesced.clear();
+}
+
+bool MessageJournal::isOpen() const {
+    return data != NULL;
+}
+
+JournalHeader* MessageJournal::header() {
+    return (JournalHeader*)data;
+}
+
+const JournalHeader* MessageJournal::header() const {
+    return (const JournalHeader*)data;
+}
+
+size_t MessageJournal::recordSize(size_t topic_size, size_t payload_size) {
+    return (sizeof(JournalRecord) + topic_size + payload_size + 7) & ~(size_t)7;
+}
+
+/* scan walks the messages of a journal which was just opened. A message cut short when the application stopped
+   while appending it ends the journal */
+void MessageJournal::scan() {
+    JournalHeader* h = header();
+    count = 0;
+    last_coalesced.clear();
+    uint64_t offset = h->read_offset;
+    while (offset < h->write_offset) {
+        JournalRecord record;
+        if (h->write_offset - offset < sizeof(record)) {
+            break;
+        }
+        memcpy(&record, data + offset, sizeof(record));
+        size_t size = recordSize(record.topic_size, record.payload_size);
+        if (h->write_offset - offset < size) {
+            break;
+        }
+        if (record.coalesce) {
+            last_coalesced[string(data + offset + sizeof(record), record.topic_size)] = offset;
+        }
+        count++;
+        offset += size;
+    }
+    h->write_offset = offset;
+    // Messages taken but not acknowledged before the journal was closed are sent again
+    next_offset = h->read_offset;
+    taken.clear();
+}
+
+bool MessageJournal::append(const string& topic, const char* payload, size_t size, bool coalesce) {
+    if (data == NULL) {
+        return false;
+    }
+    JournalHeader* h = header();
+    size_t bytes = recordSize(topic.size(), size);
+    if (length - h->write_offset < bytes) {
+        return false;
+    }
+
+    JournalRecord record;
+    memset(&record, 0, sizeof(record));
+    record.topic_size = (uint32_t)topic.size();
+    record.payload_size = (uint32_t)size;
+    record.coalesce = coalesce ? 1 : 0;
+    char* p = data + h->write_offset;
+    memcpy(p, &record, sizeof(record));
+    memcpy(p + sizeof(record), topic.data(), topic.size());
+    memcpy(p + sizeof(record) + topic.size(), payload, size);
+    if (coalesce) {
+        last_coalesced[topic] = h->write_offset;
+    }
+    // The message only becomes part of the journal once it is complete
+    h->write_offset += bytes;
+    count++;
+    return true;
+}
+
+size_t MessageJournal::take(vector<JournalMessage>& messages, size_t max) {
+    if (data == NULL) {
+        return 0;
+    }
+    JournalHeader* h = header();
+    size_t copied = 0;
+    while (copied < max && next_offset < h->write_offset) {
+        JournalRecord record;
+        memcpy(&record, data + next_offset, sizeof(record));
+        const char* topic = data + next_offset + sizeof(record);
+        bool last = true;
+        if (record.coalesce) {
+            string name(topic, record.topic_size);
+            auto it = last_coalesced.find(name);
+            last = it != last_coalesced.end() && it->second == next_offset;
+            if (last) {
+                last_coalesced.erase(it);
+            }
+        }
+        next_offset += recordSize(record.topic_size, record.payload_size);
+        count--;
+        // A replaced message is skipped without counting towards max, it is acknowledged with the next one
+        if (last) {
+            JournalMessage message;
+            message.topic.assign(topic, record.topic_size);
+            message.payload.assign(topic + record.topic_size, record.payload_size);
+            message.coalesce = record.coalesce != 0;
+            message.end = next_offset;
+            messages.push_back(message);
+            taken.push_back(make_pair(next_offset, false));
+            copied++;
+        }
+    }
+    // Replaced messages with nothing taken before them need no acknowledgement
+    commit();
+    return copied;
+}
+
+void MessageJournal::acknowledge(uint64_t end) {
+    for (auto& t: taken) {
+        if (t.first == end) {
+            t.second = true;
+            break;
+        }
+    }
+    commit();
+}
+
+void MessageJournal::commit() {
+    if (data == NULL) {
+        return;
+    }
+    JournalHeader* h = header();
+    while (!taken.empty() && taken.front().second) {
+        h->read_offset = taken.front().first;
+        taken.pop_front();
+    }
+    if (taken.empty()) {
+        h->read_offset = next_offset;
+    }
+    if (h->read_offset == h->write_offset) {
+        // Everything was sent, start over from the front
+        h->read_offset = sizeof(JournalHeader);
+        h->write_offset = sizeof(JournalHeader);
+        next_offset = sizeof(JournalHeader);
+        last_coalesced.clear();
+    }
+}
+
+bool MessageJournal::empty() const {
+    return count == 0;
+}
+
+size_t MessageJournal::size() const {
+    return count;
+}
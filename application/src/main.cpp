@@ -24,17 +24,17 @@
 #include <iostream>
 #include <stdio.h>
 #include <thread>
-#include <queue>
-#include <map>
-#include <set>
+#include <deque>
+#include <memory>
 #include <atomic>
 #include <csignal>
 #include <ctime>
+#include <chrono>
+#include <climits>
 #include <mutex>
+#include <stdexcept>
 #include <string>
 #include <syslog.h>
-#include <math.h>
-#include <float.h>
 #include <nlohmann/json.hpp>
 #include <fstream>
 
@@ -47,6 +47,32 @@
 
 // MQTT
 #include "mqtt.h"
+// Car tracking and counting
+#include "tracker.h"
+// Lock-free queues between the pipeline stages
+#include "ring.h"
+// Frame queue with drop policies
+#include "bounded_queue.h"
+// Reusable frame buffers
+#include "frame_pool.h"
+// Motion pre-filter
+#include "motion.h"
+// Detection decoding
+#include "detections.h"
+// Detection record and replay
+#include "detection_log.h"
+// Latency histograms
+#include "metrics.h"
+// MQTT payload encodings
+#include "payload.h"
+// Segmented counting of long videos
+#include "segments.h"
+// Preprocessing of the network input
+#include "preprocess.h"
+// Network cache and warm-up
+#include "network.h"
+// Lock-free publication of the counts
+#include "snapshot.h"
 
 using namespace std;
 using namespace cv;
@@ -55,21 +81,63 @@ using json = nlohmann::json;
 json jsonobj;
 
 // OpenCV-related variables
-Mat frame, blob;
-VideoCapture cap;
-int delay = 5;
 Net net;
 
 // Application parameters
 String model;
 String config;
-float carconf;
 int backendId;
 int targetId;
 string entrance;
-int max_distance;
-int max_frames_gone;
-int rate;
+bool event_mode;
+int event_window;
+int heartbeat;
+int log_every;
+int max_streams;
+int batch_size;
+int batch_wait;
+int pool_size;
+int infer_requests;
+bool adaptive_stride;
+bool motion_gate;
+double motion_band;
+bool headless;
+QueuePolicy queue_policy;
+bool auto_queue_policy;
+int queue_frames;
+size_t queue_bytes;
+int segments;
+double segment_overlap;
+int segment_threads;
+string record_path;
+string replay_path;
+int stats_interval;
+string stats_file;
+string net_cache;
+int warmup_runs;
+
+/* Settings holds the parameters which can be changed at runtime through the control topic. A published Settings
+   is never modified, a change publishes a new one. Every thread loads the current one at its next frame or batch,
+   so all the parameters of a change take effect together */
+struct Settings {
+    DetectionFilter filter;
+    int max_distance;
+    int max_frames_gone;
+    int stride;
+    // net_size is the size the frames are resized to for the network input
+    Size net_size;
+    // rate is the number of seconds between MQTT updates
+    double rate;
+};
+
+shared_ptr<const Settings> settings;
+// Mutex used to serialize the changes of the settings
+mutex settings_mutex;
+
+// currentSettings returns the current Settings
+shared_ptr<const Settings> currentSettings() {
+    return atomic_load(&settings);
+}
 
 // Flag to control background threads
 atomic<bool> keepRunning(true);
@@ -79,52 +147,154 @@ static volatile sig_atomic_t sig_caught = 0;
 
 // MQTT parameters
 const string topic = "parking/counter";
+const string stats_topic = "parking/stats";
+const string control_topic = "parking/control";
+// max_input_size bounds the width and the height of the network input given on the command line or the control topic
+const int max_input_size = 2048;
+
+// Frame is a captured video frame on its way to the inference thread
+struct Frame {
+    Mat image;
+    // motion is set when the motion gate found the frame worth sending to the detector
+    bool motion;
+    // queued is the time the frame was added to the frame queue
+    chrono::steady_clock::time_point queued;
+};
 
-// Car contains information about trajectory of tracked car
-struct Car {
-    int id;
-    vector<Point> traject;
-    bool counted;
-    bool gone;
-    int direction;
+/* info_readers is the number of threads which read the ParkingInfo snapshots of a stream at the same time: the
+   messageRunner thread, and the main thread which shows them, or reports them once the streams are done or the
+   segments are counted. Each of them holds at most one snapshot at a time, so with two more slots than readers
+   the writer always finds a free slot next to the published one */
+const size_t info_readers = 2;
+typedef Snapshots<ParkingInfo, info_readers + 2> InfoSnapshots;
+typedef InfoSnapshots::Reader InfoReader;
+
+/* Detections carries the size of a frame together with the detector output rows which belong to it. The frame
+   itself is not kept, so a tracker lagging behind does not hold on to the pooled buffers of the capture */
+struct Detections {
+    Size size;
+    FrameMode mode;
+    // rows holds the [image_id, label, conf, x_min, y_min, x_max, y_max] records of the frame
+    vector<float> rows;
 };
 
-// tracked_cars tracks detected cars by their ids
-map<int, Car> tracked_cars;
+// Stream contains the capture, frame queue and car counting state of a single config.json input
+struct Stream {
+    explicit Stream(size_t pool_size) : pool(pool_size) {}
+
+    string name;
+    string input;
+    string topic;
+    // events_topic is the sub-topic the counted cars are published to in event mode
+    string events_topic;
+    VideoCapture cap;
+    int delay;
+    // pool provides the buffers the video frames are decoded into
+    FramePool pool;
+    // gate decides which frames are worth sending to the detector, only used by the capture thread
+    MotionGate gate;
+    /* roi is the region of the frame which is sent to the detector. When roi_band is set, the region
+       is the band of that size along the entrance edge instead. An empty roi covers the whole frame */
+    Rect roi;
+    double roi_band;
+    // nextImage provides queue for captured video frames, from the capture to the inference thread
+    BoundedQueue<Frame> nextImage;
+    // queueWait is the time the frames of the stream spent in the frame queue
+    LatencyHistogram queueWait;
+    // nextDetections provides queue for inference results, from the inference to the tracking thread
+    SpscRing<Detections> nextDetections{300};
+    // counter is the car tracking state, only touched by the frameRunner thread of the stream
+    CounterContext counter;
+    /* info holds the latest ParkingInfo snapshot as tracked by the stream. A published snapshot is never
+       modified, the frameRunner thread fills a free slot and publishes it, so readers neither take a lock
+       nor copy the snapshot. The slots are reused, so in steady state publishing does not allocate */
+    InfoSnapshots info;
+    // events holds the counted cars which have not been published yet in event mode
+    vector<StampedEvent> events;
+    // Mutex used to control thread access to the events and the snapshot published with them
+    mutex m4;
+    // displayFrame holds the latest captured frame which has not been shown yet
+    Mat displayFrame;
+    // overlay is the main thread's copy of the display frame, which the analytics info is drawn on
+    Mat overlay;
+    // Mutex used to control thread access to the display frame
+    mutex m3;
+    // Set by the capture thread once the video source is exhausted
+    atomic<bool> finished;
+    // Number of frames queued for inference
+    atomic<long> captured;
+    // Number of frames that went through inference and tracking
+    atomic<long> processed;
+    // Number of queued frames the queue policy dropped before inference
+    atomic<long> evicted;
+    // Number of frames that skipped the detector because of no motion
+    atomic<long> idle;
+    // stride is the current detection stride of the stream as decided by its tracking thread
+    atomic<int> stride;
+    // Number of frames since the last frame sent to the detector, only used by the inference thread
+    int since_detect;
+    // settings the tracker of the stream was last updated with, only used by the frameRunner thread
+    shared_ptr<const Settings> settings;
+    // recorder writes the detections of the stream to a log file when recording, only used by the frameRunner thread
+    DetectionWriter recorder;
+    // replay is the detection log which is tracked instead of the video in replay mode
+    DetectionReader replay;
+};
 
-// id is a counter used to generate ids for tracked centroids
-int id = 0;
+// streams holds one Stream per processed config.json input
+vector<unique_ptr<Stream>> streams;
 
-// Centroid is the center point of detected car rectangle
-struct Centroid {
-    int id;
-    Point p;
-    int gone_count;
+// StageStats accumulates the number of frames a pipeline stage handled and the time it was busy with them
+struct StageStats {
+    const char* name;
+    atomic<long> frames;
+    atomic<long> busy_us;
 };
 
-// centroids maps centroids by their ids
-map<int, Centroid> centroids;
-
-// Total cars in and out of the parking
-int total_in = 0;
-int total_out = 0;
+// Statistics of the capture, inference and tracking stages summed over all their threads
+StageStats capture_stats = {"Capture", {0}, {0}};
+StageStats inference_stats = {"Inference", {0}, {0}};
+StageStats tracking_stats = {"Tracking", {0}, {0}};
+
+/* Latency histograms of the pipeline steps in microseconds. Capture, queue wait and the tracking steps are
+   recorded per frame, preprocessing and the forward pass per batch and publishing per message */
+LatencyHistogram capture_latency;
+LatencyHistogram queue_latency;
+LatencyHistogram preprocess_latency;
+LatencyHistogram forward_latency;
+LatencyHistogram decode_latency;
+LatencyHistogram associate_latency;
+LatencyHistogram count_latency;
+LatencyHistogram publish_latency;
+
+/* Startup times in milliseconds: reading the network, warming it up, and from the start of the process to the
+   first detection on a frame, which stays -1 until then */
+chrono::steady_clock::time_point started_at;
+double load_ms = 0;
+double warmup_ms = 0;
+atomic<long> first_detection_ms(-1);
+
+// StepLatency names the histogram of a pipeline step in the statistics
+struct StepLatency {
+    const char* name;
+    LatencyHistogram* histogram;
+};
 
-// ParkingInfo contains information about available parking spaces
-struct ParkingInfo
-{
-    int total_in;
-    int total_out;
-    map<int, Centroid> centroids;
+const StepLatency step_latencies[] = {
+    {"capture", &capture_latency},
+    {"queue_wait", &queue_latency},
+    {"preprocess", &preprocess_latency},
+    {"forward", &forward_latency},
+    {"decode", &decode_latency},
+    {"associate", &associate_latency},
+    {"count", &count_latency},
+    {"publish", &publish_latency},
 };
 
-// currentInfo contains the latest ParkingInfo as tracked by the application
-ParkingInfo currentInfo;
-// nextImage provides queue for captured video frames
-queue<Mat> nextImage;
 // currentPerf stores the label which contains application performance information
 String currentPerf;
 // Mutexes used in program to control thread access to shared variables
-mutex m, m1, m2;
+mutex m1;
 
 const char* keys =
     "{ help     | | Print help message. }"
@@ -133,6 +303,9 @@ const char* keys =
     "{ model m     | | Path to .bin file of model containing face recognizer. }"
     "{ config c    | | Path to .xml file of model containing network configuration. }"
     "{ carconf cc  | 0.5 | Confidence factor for car detection required. }"
+    "{ min_car_size mcs | 70 | Min width and height in pixels of a detected car. }"
+    "{ clip_width cw | 200 | Max width in pixels of a detected car, wider detections are clipped. }"
+    "{ clip_height ch | 350 | Max height in pixels of a detected car, higher detections are clipped. }"
     "{ backend b   | 0 | Choose one of computation backends: "
                         "0: automatically (by default), "
                         "1: Halide language (http://halide-lang.org/), "
@@ -150,54 +323,124 @@ const char* keys =
                         "r: Right frame }"
     "{ max_distance md  | 200 | Max distance in pixels between two related centroids. }"
     "{ max_frames_gone mg | 25 | Max number of frames to track the centroid which does not change. }"
-    "{ rate r      | 0.5 | Number of seconds between data updates to MQTT server. }";
+    "{ rate r      | 0.5 | Number of seconds between data updates to MQTT server. }"
+    "{ events ev   | false | Publish every car counted in or out instead of the counts every rate seconds. }"
+    "{ event_window ew | 1000 | Number of milliseconds the counted cars are batched into a single message in event mode. }"
+    "{ heartbeat hb | 60 | Number of seconds between updates of the counts in event mode. }"
+    "{ payload pl  | json | Encoding of the MQTT counts and events: json, cbor, msgpack or binary. }"
+    "{ log_every le | 100 | Log every n-th published MQTT message to syslog. 0 disables the logging. }"
+    "{ journal jn  | | Keep the MQTT messages in this journal file while the MQTT server is unreachable. }"
+    "{ journal_size js | 64 | Size of the MQTT journal file in megabytes. }"
+    "{ streams s   | 0 | Number of config.json inputs to process. 0 processes all of them. }"
+    "{ batch bs    | 1 | Number of frames run through the network in a single inference request. }"
+    "{ batch_wait bw | 10 | Max number of milliseconds to wait for a full batch of frames. }"
+    "{ pool p      | 32 | Number of frame buffers per input which video frames are decoded into. }"
+    "{ requests nr | 1 | Number of inference requests kept in flight. More than 1 needs the Inference Engine backend. }"
+    "{ stride ds   | 1 | Run the car detector on every stride-th frame only, cars are tracked by their velocity in between. }"
+    "{ adaptive_stride as | false | Shorten the detection stride down to every frame while cars move fast. }"
+    "{ motion_gate mo | false | Skip the detector on frames without motion near the entrance. }"
+    "{ motion_band mb | 0.3 | Size of the band along the entrance watched for motion, as a fraction of the frame size. }"
+    "{ input_size is | 672x384 | Width and height the frames are resized to for the network input. }"
+    "{ headless hl | false | Process the inputs as fast as possible without displaying them. }"
+    "{ record rec  | | Write the detections of every input to this detection log file. }"
+    "{ replay rp   | | Track the detections of this detection log file instead of running the detector on the video. }"
+    "{ stats_interval si | 10 | Number of seconds between pipeline statistics updates. 0 disables them. }"
+    "{ stats_file sf | | Append the pipeline statistics to this file, one JSON object per line. }"
+    "{ net_cache nc | | Keep the GPU and OpenCL compile caches in this directory, the CPU target has none. }"
+    "{ warmup wu   | 2 | Number of inference runs on a black frame before the capture starts. 0 disables the warm-up. }"
+    "{ queue_policy qp | auto | What to do with a captured frame when the frame queue is full: "
+                        "drop_newest: drop the frame, "
+                        "drop_oldest: drop the oldest queued frames, "
+                        "latest: keep the latest frame only, "
+                        "block: wait for the inference thread, "
+                        "auto: block for video files, drop_oldest for cameras and network streams }"
+    "{ queue_frames qf | 24 | Max number of frames in the frame queue of every input. 0 lifts the limit. }"
+    "{ queue_mb qm | 0 | Max size in megabytes of the frames in the frame queue of every input. 0 lifts the limit. }"
+    "{ segments sg | 0 | Count a single video file in this many segments side by side. 0 disables it. }"
+    "{ overlap ov  | 10 | Number of seconds a segment is tracked before and after its own frames. }"
+    "{ segment_threads sj | 0 | Number of segments counted at once. 0 uses all the CPU cores. }";
+
+// nextImageAvailable returns the next frame from the stream queue, or a frame with an empty image when there is none
+Frame nextImageAvailable(Stream& s) {
+    Frame rtn;
+    s.nextImage.pop(rtn);
+    return rtn;
+}
 
-// nextImageAvailable returns the next image from the queue in a thread-safe way
-Mat nextImageAvailable() {
-    Mat rtn;
-    m.lock();
-    if (!nextImage.empty()) {
-        rtn = nextImage.front();
-        nextImage.pop();
+/* addImage adds a frame to the stream queue. When the queue is full, the queue policy of the stream decides
+   whether the frame or older frames are dropped, or whether it waits for the inference thread to make room.
+   Older frames dropped from the queue had been counted as captured, they are counted as evicted as well */
+void addImage(Stream& s, const Frame& img) {
+    size_t evicted = 0;
+    bool queued = s.nextImage.push(img, img.image.total() * img.image.elemSize(), evicted);
+    s.evicted += evicted;
+    if (queued) {
+        s.captured++;
     }
-    m.unlock();
+}
+
+// addStageTime adds frames and the time passed since start to the statistics of a pipeline stage
+void addStageTime(StageStats& stats, long frames, chrono::steady_clock::time_point start) {
+    stats.frames += frames;
+    stats.busy_us += chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+}
+
+// nextDetectionsAvailable returns the next inference result from the stream queue, or an empty result when there is none
+Detections nextDetectionsAvailable(Stream& s) {
+    Detections rtn;
+    s.nextDetections.pop(rtn);
     return rtn;
 }
 
-// addImage adds an image to the queue in a thread-safe way
-void addImage(Mat img) {
-    m.lock();
-    if (nextImage.size() < 300) {
-        nextImage.push(img);
+/* addDetections adds an inference result to the stream queue. Results are never dropped, as the tracker
+   relies on seeing every frame, so it waits for the tracking thread to make room instead */
+void addDetections(Stream& s, const Detections& d) {
+    Backoff backoff;
+    while (!s.nextDetections.push(d) && keepRunning.load()) {
+        backoff.pause();
+    }
+}
+
+// frameRoi returns the region of a frame of the given size which is sent to the detector
+Rect frameRoi(const Stream& s, Size size) {
+    Rect frame(0, 0, size.width, size.height);
+    if (s.roi_band > 0) {
+        return entranceBand(size, s.counter.entrance, s.roi_band);
+    }
+    if (s.roi.area() > 0) {
+        Rect roi = s.roi & frame;
+        if (roi.area() > 0) {
+            return roi;
+        }
     }
-    m.unlock();
+    return frame;
 }
 
-// getCurrentInfo returns the most-recent ParkingInfo for the application.
-ParkingInfo getCurrentInfo() {
-    m2.lock();
-    ParkingInfo info;
-    info = currentInfo;
-    m2.unlock();
-    return info;
+// getCurrentInfo returns the most-recent ParkingInfo snapshot for the stream.
+InfoReader getCurrentInfo(Stream& s) {
+    return s.info.read();
 }
 
-// updateInfo updates the current ParkingInfo for the application to the latest detected values
-void updateInfo() {
-    m2.lock();
-    currentInfo.total_in = total_in;
-    currentInfo.total_out = total_out;
-    currentInfo.centroids = centroids;
-    m2.unlock();
+/* updateInfo publishes a snapshot of the latest detected values as the current ParkingInfo for the stream.
+   Only the frameRunner thread of the stream calls it */
+void updateInfo(Stream& s) {
+    // Only a reader beyond info_readers could hold every slot, the snapshot is then left as it was
+    ParkingInfo* next = s.info.acquire();
+    if (next == NULL) {
+        return;
+    }
+    counterInfo(s.counter, *next);
+    s.info.publish(next);
 }
 
-// resetInfo resets the current ParkingInfo for the application.
-void resetInfo() {
-    m2.lock();
-    currentInfo.total_in = 0;
-    currentInfo.total_out = 0;
-    currentInfo.centroids = map<int, Centroid>();
-    m2.unlock();
+// resetInfo resets the current ParkingInfo for the stream.
+void resetInfo(Stream& s) {
+    ParkingInfo* next = s.info.acquire();
+    if (next == NULL) {
+        return;
+    }
+    *next = ParkingInfo();
+    s.info.publish(next);
 }
 
 // getCurrentPerf returns a display string with the most current performance stats for the Inference Engine.
@@ -209,383 +452,957 @@ string getCurrentPerf() {
     return perf;
 }
 
-// savePerformanceInfo sets the display string with the most current performance stats for the Inference Engine.
+/* savePerformanceInfo sets the display string with the most current performance stats for the Inference Engine.
+   Only the inference thread calls into the net, so m1 only guards the string */
 void savePerformanceInfo() {
-    m1.lock();
     vector<double> times;
     double freq = getTickFrequency() / 1000;
     double t = net.getPerfProfile(times) / freq;
     string label = format("Car inference time: %.2f ms", t);
+    m1.lock();
     currentPerf = label;
     m1.unlock();
 }
 
-// Publish MQTT message with a JSON payload
+/* encoder encodes the MQTT payloads in the format chosen by the payload flag. Only the messageRunner thread
+   publishes counts and events, so it is the only user of the encoder */
+PayloadEncoder encoder;
+// Number of MQTT messages published by the messageRunner thread, to sample the ones logged to syslog
+long publish_count;
+
+// logMQTTMessage logs every log_every-th published message to syslog, binary payloads by their size only
+void logMQTTMessage(const string& topic) {
+    publish_count++;
+    if (log_every <= 0 || publish_count % log_every != 0) {
+        return;
+    }
+    syslog(LOG_INFO, "MQTT message published to topic: %s", topic.c_str());
+    if (encoder.format() == PAYLOAD_JSON) {
+        syslog(LOG_INFO, "%.*s", (int)encoder.size(), encoder.data());
+    } else {
+        syslog(LOG_INFO, "%s payload of %zu bytes", payloadFormatName(encoder.format()), encoder.size());
+    }
+}
+
+// Publish MQTT message with the counts of the stream
 void publishMQTTMessage(const string& topic, const ParkingInfo& info) {
-    ostringstream s;
-    s << "{\"TOTAL_IN\": \"" << info.total_in << "\" \"TOTAL_OUT\": \"" << info.total_out << "\"}";
-    string payload = s.str();
-    mqtt_publish(topic, payload);
-    string msg = "MQTT message published to topic: " + topic;
-    syslog(LOG_INFO, "%s", msg.c_str());
-    syslog(LOG_INFO, "%s", payload.c_str());
+    encoder.counts(info);
+    mqtt_publish_payload(topic, encoder.data(), encoder.size());
+    logMQTTMessage(topic);
+}
+
+/* publishMQTTEvents publishes the counted cars to the events sub-topic of the stream. Every event has to arrive,
+   so the messages are never coalesced */
+void publishMQTTEvents(const string& topic, const vector<StampedEvent>& events, const ParkingInfo& info) {
+    encoder.events(info, events);
+    mqtt_publish_payload(topic, encoder.data(), encoder.size(), false);
+    logMQTTMessage(topic);
+}
+
+/* parseInputSize reads a network input size given as WIDTHxHEIGHT. It returns false, with the reason in error, when
+   the text has any other form or the width or the height is not between 1 and max_input_size */
+bool parseInputSize(const string& text, Size& size, string& error) {
+    char rest;
+    if (sscanf(text.c_str(), "%dx%d%c", &size.width, &size.height, &rest) != 2) {
+        error = "invalid input_size, it must be WIDTHxHEIGHT";
+        return false;
+    }
+    if (size.width < 1 || size.height < 1 || size.width > max_input_size || size.height > max_input_size) {
+        error = format("input_size out of range, the width and the height must be between 1 and %d", max_input_size);
+        return false;
+    }
+    return true;
+}
+
+/* settingInt returns the value of a whole number parameter of the control topic. A fractional or out of range number
+   would be truncated silently, so it is rejected like a value of the wrong type */
+int settingInt(const json& value, const string& key) {
+    if (!value.is_number_integer() || value.get<long long>() < INT_MIN || value.get<long long>() > INT_MAX) {
+        throw invalid_argument(key + " must be an integer");
+    }
+    return value.get<int>();
+}
+
+// settingNumber returns the value of a numeric parameter of the control topic, a boolean is not taken for 0 or 1
+double settingNumber(const json& value, const string& key) {
+    if (!value.is_number()) {
+        throw invalid_argument(key + " must be a number");
+    }
+    return value.get<double>();
+}
+
+/* parseSettings applies the parameters of a control message to next. It returns false, with the reason in error,
+   when the message isn't a JSON object or any of its parameters is unknown or invalid */
+bool parseSettings(const string& payload, Settings& next, string& error) {
+    error.clear();
+    try {
+        json msg = json::parse(payload);
+        if (!msg.is_object()) {
+            error = "not a JSON object";
+            return false;
+        }
+        for (auto it = msg.begin(); it != msg.end(); ++it) {
+            const string key = it.key();
+            const json& value = it.value();
+            if (key == "carconf") {
+                next.filter.confidence = (float)settingNumber(value, key);
+            } else if (key == "min_car_size") {
+                next.filter.min_size = settingInt(value, key);
+            } else if (key == "clip_width") {
+                next.filter.clip_width = settingInt(value, key);
+            } else if (key == "clip_height") {
+                next.filter.clip_height = settingInt(value, key);
+            } else if (key == "max_distance") {
+                next.max_distance = settingInt(value, key);
+            } else if (key == "max_frames_gone") {
+                next.max_frames_gone = settingInt(value, key);
+            } else if (key == "stride") {
+                next.stride = settingInt(value, key);
+            } else if (key == "input_size") {
+                Size size;
+                if (!parseInputSize(value.get<string>(), size, error)) {
+                    return false;
+                }
+                next.net_size = size;
+            } else if (key == "rate") {
+                next.rate = settingNumber(value, key);
+            } else {
+                error = "unknown parameter " + key;
+                return false;
+            }
+        }
+    } catch (const exception& e) {
+        error = e.what();
+        return false;
+    }
+    // The negated comparisons also catch NaN
+    if (!(next.filter.confidence >= 0 && next.filter.confidence <= 1)) {
+        error = "carconf out of range, it must be between 0 and 1";
+    } else if (next.filter.min_size < 0) {
+        error = "min_car_size out of range, it must not be negative";
+    } else if (next.filter.clip_width <= 0 || next.filter.clip_height <= 0) {
+        error = "clip_width or clip_height out of range, they must be positive";
+    } else if (next.max_distance <= 0) {
+        error = "max_distance out of range, it must be positive";
+    } else if (next.max_frames_gone < 0) {
+        error = "max_frames_gone out of range, it must not be negative";
+    } else if (next.stride < 1) {
+        error = "stride out of range, it must be at least 1";
+    } else if (!(next.rate > 0)) {
+        error = "rate out of range, it must be positive";
+    }
+    return error.empty();
 }
 
-// Message handler for the MQTT subscription for any desired control channel topic
-int handleMQTTControlMessages(void *context, char *topicName, int topicLen, MQTTClient_message *message) {
+/* Message handler for the MQTT subscription of the control topic. A message is a JSON object of the parameters to
+   change, for example {"carconf": 0.6, "stride": 2}. Either all of them change at once or, when any of them is
+   invalid, none */
+int handleMQTTControlMessages(void *context, char *topicName, int topicLen, MQTTAsync_message *message) {
     string topic = topicName;
+    string payload((const char*)message->payload, message->payloadlen);
+    MQTTAsync_freeMessage(&message);
+    MQTTAsync_free(topicName);
     string msg = "MQTT message received: " + topic;
     syslog(LOG_INFO, "%s", msg.c_str());
+    if (topic != control_topic) {
+        return 1;
+    }
+
+    settings_mutex.lock();
+    Settings next = *currentSettings();
+    string error;
+    bool valid = parseSettings(payload, next, error);
+    if (valid) {
+        atomic_store(&settings, shared_ptr<const Settings>(make_shared<Settings>(next)));
+    }
+    settings_mutex.unlock();
+
+    if (valid) {
+        syslog(LOG_INFO, "Settings changed: %s", payload.c_str());
+        cout << "Settings changed: " << payload << endl;
+    } else {
+        syslog(LOG_WARNING, "Settings not changed, %s: %s", error.c_str(), payload.c_str());
+        cerr << "Settings not changed, " << error << ": " << payload << endl;
+    }
     return 1;
 }
 
-/* closestCentroid finds the id of the tracked centroid which is the closest to the point passed in as parameter.
-   The function uses Euclidean distance as a measure of the closeness of the points and returns both as a pair */
-pair<int, double> closestCentroid(const Point p, const map<int, Centroid> centroids) {
-    int id = 0;
-    double dist = DBL_MAX;
-
-    for (map<int, Centroid>::const_iterator it = centroids.begin(); it != centroids.end(); ++it) {
-         int _id = it->second.id;
-         Point _p = it->second.p;
-
-         // If the movement is horizontal, only consider centroids with some small Y coordinate fluctuation
-         if (entrance.compare("l") == 0 || entrance.compare("r") == 0) {
-             if ((_p.y < (p.y-70)) || (_p.y > (p.y+70))){
-                 continue;
-             }
-         }
-
-         // If the movement is vertical, only consider centroids with some small X coordinate fluctuation
-         if (entrance.compare("b") == 0 || entrance.compare("t") == 0) {
-             if (_p.x < (p.x-50) || _p.x > (p.x+50)){
-                 continue;
-             }
-         }
-
-         double dx = double(p.x - _p.x);
-         double dy = double(p.y - _p.y);
-         double _dist = sqrt(dx*dx + dy*dy);
-
-         if (_dist < dist) {
-             dist = _dist;
-             id = _id;
-         }
-    }
-    return make_pair(id, dist);
-}
-
-// addCentroid adds a new centroid to the list of tracked centroids and increments id counter
-void addCentroid(Point p) {
-    Centroid c;
-    c.id = id;
-    c.p = p;
-    c.gone_count = 0;
-    centroids[c.id] = c;
-    id++;
-}
-
-// removeCentroid removes existing centroid from the list of tracked centroids
-void removeCentroid(int id) {
-    centroids.erase(id);
-    // Find gone centroid id in tracked cars map and mark it as gone
-    if (tracked_cars.find(id) != tracked_cars.end()){
-        tracked_cars[id].gone = true;
-    }
-}
-
-// updateCentroids takes detected centroid points and updates tracked centroids
-void updateCentroids(vector<Point> points) {
-    if (points.size() == 0) {
-        for (map<int, Centroid>::iterator it = centroids.begin(); it != centroids.end(); ++it) {
-            it->second.gone_count++;
-            if (it->second.gone_count > max_frames_gone) {
-                removeCentroid(it->second.id);
+/* collectBatch gathers up to batch_size frames from the queues of all the streams. Frames are taken
+   round-robin, so a busy stream can fill the batch with several of its queued frames while the others
+   still get their turn. Once the first frame is collected, it waits at most batch_wait milliseconds
+   for the batch to fill up. Frames of each stream are kept in their capture order.
+   Frames in between the detection stride of their stream or without motion are collected too, so they stay
+   in order with the rest of the frames, but they are marked to skip the detector and do not count towards
+   batch_size. Only the frames marked for detection keep their pooled buffer, the others are left empty and
+   sizes holds the size of every frame. When wait is false, it returns right away if no frame is queued */
+void collectBatch(vector<Mat>& frames, vector<Size>& sizes, vector<Stream*>& owners, vector<FrameMode>& modes,
+                  bool wait) {
+    chrono::steady_clock::time_point deadline;
+    Backoff backoff;
+    int detect_count = 0;
+    while (keepRunning.load() && detect_count < batch_size) {
+        bool added = false;
+        for (auto& s: streams) {
+            if (detect_count == batch_size) {
+                break;
+            }
+            Frame next = nextImageAvailable(*s);
+            if (!next.image.empty()) {
+                queue_latency.recordSince(next.queued);
+                s->queueWait.recordSince(next.queued);
+                if (frames.empty()) {
+                    deadline = chrono::steady_clock::now() + chrono::milliseconds(batch_wait);
+                }
+                /* An idle frame does not restart the stride, so the first frame with motion
+                   goes straight to the detector */
+                FrameMode mode = IDLE;
+                if (next.motion) {
+                    mode = PREDICTED;
+                    if (++s->since_detect >= s->stride.load()) {
+                        s->since_detect = 0;
+                        mode = DETECTED;
+                        detect_count++;
+                    }
+                }
+                frames.push_back(mode == DETECTED ? next.image : Mat());
+                sizes.push_back(next.image.size());
+                owners.push_back(s.get());
+                modes.push_back(mode);
+                added = true;
             }
         }
-        return;
+
+        if (added) {
+            backoff.reset();
+            continue;
+        }
+        if (frames.empty() && !wait) {
+            break;
+        }
+        if (!frames.empty() && chrono::steady_clock::now() >= deadline) {
+            break;
+        }
+        // Wait for the capture threads instead of spinning on empty queues
+        backoff.pause();
     }
+}
 
-    if (centroids.empty()) {
-        for(const auto& p: points) {
-            addCentroid(p);
+/* prepareBatch converts the region of interest of the frames marked for detection to the 4d NCHW blob
+   required by vehicle detection model. The batch is padded up to batch_size with the last frame, so the
+   network input keeps the same shape and is only reinitialized when the input size is changed at runtime.
+   Returns false when no frame needs the detector */
+bool prepareBatch(const vector<Mat>& frames, const vector<Stream*>& owners, const vector<FrameMode>& modes,
+                  BlobResizer& resizer, Mat& blob, Size net_size) {
+    vector<Mat> images;
+    for (size_t k = 0; k < frames.size(); k++) {
+        if (modes[k] == DETECTED) {
+            // Cropping only creates a view of the pooled frame, the pixels are read once while resizing
+            images.push_back(frames[k](frameRoi(*owners[k], frames[k].size())));
         }
-    } else {
-        set<int> checked_points;
-        set<int> checked_centroids;
-        // Iterate through all detected points and update tracked centroid positions
-        for(vector<Point>::size_type i = 0; i != points.size(); i++) {
-            pair<int, double> closest = closestCentroid(points[i], centroids);
-
-            /* If the distance from the point to the closest centroid is too large, don't associate them together.
-               Also avoid associating with centroid which already has a different association */
-            if (closest.second > max_distance || (checked_points.find(closest.first) != checked_points.end())) {
+    }
+    if (images.empty()) {
+        return false;
+    }
+    while (images.size() < (size_t)batch_size) {
+        images.push_back(images.back());
+    }
+    resizer.batch(images, blob, net_size);
+    return true;
+}
+
+/* scatterDetections hands the 1x1xNx7 output rows to the trackers of the streams the frames came from.
+   Image ids of the rows count the frames which went through the detector only */
+void scatterDetections(const Mat& result, const vector<Size>& sizes, const vector<Stream*>& owners,
+                       const vector<FrameMode>& modes) {
+    vector<size_t> index;
+    vector<Detections> detections(sizes.size());
+    for (size_t k = 0; k < sizes.size(); k++) {
+        detections[k].size = sizes[k];
+        detections[k].mode = modes[k];
+        if (modes[k] == DETECTED) {
+            index.push_back(k);
+        }
+    }
+
+    const float* data = (const float*)result.data;
+    for (size_t i = 0; i < result.total(); i += 7) {
+        int image = (int)data[i];
+        // Skip the unused rows and the rows of the padding frames
+        if (image < 0 || image >= (int)index.size()) {
+            continue;
+        }
+        vector<float>& rows = detections[index[image]].rows;
+        rows.insert(rows.end(), data + i, data + i + 7);
+    }
+
+    for (size_t k = 0; k < sizes.size(); k++) {
+        addDetections(*owners[k], detections[k]);
+    }
+
+    if (!result.empty() && first_detection_ms.load() < 0) {
+        first_detection_ms = (long)chrono::duration_cast<chrono::milliseconds>(
+            chrono::steady_clock::now() - started_at).count();
+        cout << "Time to first detection: " << first_detection_ms.load() << " ms" << endl;
+    }
+}
+
+/* InferRequest is a batch of frames whose inference runs asynchronously. A batch of frames which all
+   skip the detector has no result to wait for. The pixels are in the input blob already, so only the
+   frame sizes are kept */
+struct InferRequest {
+    vector<Size> sizes;
+    vector<Stream*> owners;
+    vector<FrameMode> modes;
+    AsyncArray result;
+    // started is the time the forward pass was started
+    chrono::steady_clock::time_point started;
+};
+
+/* Function called by worker thread to run the frames of all the streams through the network.
+   Each batch goes through a single forward pass and the detections are scattered back to the
+   stream which captured the frame.
+   With more than one inference request, up to that many batches run asynchronously while the next
+   batch is being collected and preprocessed. Requests are completed oldest first, so each tracker
+   still gets its frames in capture order */
+void inferenceRunner() {
+    // Every request in flight needs its own input blob, they are reused round-robin
+    vector<Mat> blobs(infer_requests);
+    size_t next_blob = 0;
+    BlobResizer resizer;
+    deque<InferRequest> inflight;
+    Backoff backoff;
+
+    while (keepRunning.load()) {
+        vector<Mat> frames;
+        vector<Size> sizes;
+        vector<Stream*> owners;
+        vector<FrameMode> modes;
+        if (inflight.size() < (size_t)infer_requests) {
+            // Only block waiting for frames when there is no request to complete
+            collectBatch(frames, sizes, owners, modes, inflight.empty());
+        }
+        chrono::steady_clock::time_point busy = chrono::steady_clock::now();
+
+        if (!frames.empty()) {
+            Mat& blob = blobs[next_blob];
+            bool run = prepareBatch(frames, owners, modes, resizer, blob, currentSettings()->net_size);
+            // Hand the pooled buffers back to the capture as soon as the pixels are in the blob
+            frames.clear();
+            if (run) {
+                preprocess_latency.recordSince(busy);
+                next_blob = (next_blob + 1) % blobs.size();
+                net.setInput(blob);
+            }
+
+            if (infer_requests == 1 || (!run && inflight.empty())) {
+                Mat result;
+                if (run) {
+                    chrono::steady_clock::time_point started = chrono::steady_clock::now();
+                    result = net.forward();
+                    forward_latency.recordSince(started);
+                    savePerformanceInfo();
+                }
+                scatterDetections(result, sizes, owners, modes);
+                addStageTime(inference_stats, sizes.size(), busy);
                 continue;
             }
-            // Update position of the closest centroid
-            centroids[closest.first].p = points[i];
-            centroids[closest.first].gone_count = 0;
-            // Add centroids to checked points
-            checked_points.insert(i);
-            checked_centroids.insert(closest.first);
-        }
-
-        /* Iterate through all *already tracked* centroids and increment their gone frame count, 
-           if they weren't updated from the list of detected centroid points */
-        for (map<int, Centroid>::iterator it = centroids.begin(); it != centroids.end(); ++it) {
-            // If centroid wasn't updated, we assume it's missing from the frame
-            if (checked_centroids.find(it->second.id) == checked_centroids.end()) {
-                it->second.gone_count++;
-                if (it->second.gone_count > max_frames_gone) {
-                    removeCentroid(it->second.id);
+
+            InferRequest request;
+            request.sizes = sizes;
+            request.owners = owners;
+            request.modes = modes;
+            try {
+                if (run) {
+                    request.started = chrono::steady_clock::now();
+                    request.result = net.forwardAsync();
                 }
+            } catch (const cv::Exception& e) {
+                cerr << "Asynchronous inference is not supported by the backend, "
+                        "falling back to a single synchronous request" << endl;
+                infer_requests = 1;
+                chrono::steady_clock::time_point started = chrono::steady_clock::now();
+                Mat result = net.forward();
+                forward_latency.recordSince(started);
+                savePerformanceInfo();
+                scatterDetections(result, sizes, owners, modes);
+                addStageTime(inference_stats, sizes.size(), busy);
+                continue;
             }
+            inflight.push_back(request);
+            addStageTime(inference_stats, sizes.size(), busy);
+            backoff.reset();
+            continue;
         }
 
-        /* Iterate through *detected* centroids and add the ones which werent associated
-           with any of the tracked centroids and add start tracking them */
-        for(vector<Point>::size_type i = 0; i != points.size(); i++) {
-            // If detected point was not associated with any already tracked centroids we add it in
-            if (checked_points.find(i) == checked_points.end()) {
-                addCentroid(points[i]);
-            }
+        if (inflight.empty()) {
+            continue;
         }
+
+        // Complete the oldest request, block on it only when no other request can be started
+        InferRequest& oldest = inflight.front();
+        bool pending = oldest.result.valid();
+        if (pending && inflight.size() < (size_t)infer_requests && !oldest.result.wait_for(chrono::nanoseconds(0))) {
+            backoff.pause();
+            continue;
+        }
+        Mat result;
+        if (pending) {
+            oldest.result.get(result);
+            // The latency of an asynchronous request includes the time it waited for its turn
+            forward_latency.recordSince(oldest.started);
+        }
+        scatterDetections(result, oldest.sizes, oldest.owners, oldest.modes);
+        inflight.pop_front();
+        addStageTime(inference_stats, 0, busy);
+        backoff.reset();
     }
-    return;
+
+    cout << "Inference thread stopped" << endl;
 }
 
-/* carMovement calculates movement of the car along particular movement axis according to the entrance position
-   as a mean value of all the previous poisitions of the car centroids and returns it */
-int carMovement(vector<Point> traject, string entrance) {
-    int mean_movement = 0;
+/* nextStride returns the detection stride for the next frames of the stream. In adaptive mode the stride is
+   shortened so the fastest visible car moves at most a quarter of max_distance between two detections */
+int nextStride(const CounterContext& ctx, int detect_stride) {
+    if (!adaptive_stride || detect_stride <= 1) {
+        return detect_stride;
+    }
+    double speed = maxCarSpeed(ctx, detect_stride);
+    if (speed <= 0) {
+        return detect_stride;
+    }
+    return max(1, min(detect_stride, (int)(ctx.max_distance / 4 / speed)));
+}
 
-    for(vector<Point>::size_type i = 0; i != traject.size(); i++) {
-        // When movement is horizontal only consider trajectory along X axis
-        if (entrance.compare("l") == 0 || entrance.compare("r") == 0) {
-            mean_movement = mean_movement + traject[i].x;
+/* trackFrame updates the car tracker of the stream with the next frame. For a detected frame rows holds its count
+   detection rows, relative to roi. time is the time of the frame in milliseconds since the epoch */
+void trackFrame(Stream& s, FrameMode mode, const float* rows, size_t count, Size size, Rect roi, long long time) {
+    if (mode == IDLE) {
+        // Nothing moves near the entrance, no cars are reported so the tracked ones age
+        s.idle++;
+    }
+    // Settings changed through the control topic take effect between two frames
+    shared_ptr<const Settings> cfg = currentSettings();
+    if (cfg != s.settings) {
+        s.counter.max_distance = cfg->max_distance;
+        s.counter.max_frames_gone = cfg->max_frames_gone;
+        s.settings = cfg;
+    }
+    TrackTimings timings;
+    trackDetections(s.counter, mode, rows, count, size, roi, cfg->filter, cfg->stride, &timings);
+    if (mode == DETECTED) {
+        decode_latency.record(timings.decode_us);
+    }
+    associate_latency.record(timings.associate_us);
+    count_latency.record(timings.count_us);
+    if (event_mode && !s.counter.events.empty()) {
+        // The cars are published together with the counts they add up to, so events agree with their totals
+        s.m4.lock();
+        for (auto const& e: s.counter.events) {
+            StampedEvent stamped = {e, time};
+            s.events.push_back(stamped);
         }
-        // When movement is vertical only consider trajectory along Y axis
-        if (entrance.compare("b") == 0 || entrance.compare("t") == 0) {
-            mean_movement = mean_movement + traject[i].y;
+        updateInfo(s);
+        s.m4.unlock();
+    } else {
+        // Update analytics info
+        updateInfo(s);
+    }
+    s.stride = nextStride(s.counter, cfg->stride);
+    s.processed++;
+}
+
+// Function called by worker thread to track the cars detected in the next available video frame of the stream.
+void frameRunner(Stream* s) {
+    Backoff backoff;
+    while (keepRunning.load()) {
+        Detections d = nextDetectionsAvailable(*s);
+        if (d.size.area() == 0) {
+            backoff.pause();
+            continue;
+        }
+        backoff.reset();
+        chrono::steady_clock::time_point busy = chrono::steady_clock::now();
+
+        Size size = d.size;
+        // Detections are relative to the region of interest, map them back to the full frame
+        Rect roi = frameRoi(*s, size);
+        size_t count = d.rows.size() / 7;
+        int64_t now = chrono::duration_cast<chrono::microseconds>(
+            chrono::system_clock::now().time_since_epoch()).count();
+        if (s->recorder.isOpen()) {
+            s->recorder.write(s->processed.load(), d.mode, now, d.rows.data(), count, 7, size, roi);
         }
+        trackFrame(*s, d.mode, d.rows.data(), count, size, roi, now / 1000);
+        addStageTime(tracking_stats, 1, busy);
     }
 
-    // Calculate average centroid movement
-    mean_movement = mean_movement / traject.size();
-    return mean_movement;
+    cout << "Video processing thread stopped: " << s->name << endl;
 }
 
-/* carDirection calculates the direction of the car movement along particular movement axis based on
-   the entrance position as a difference between current car's position and its previous movement */
-int carDirection(Point p, int movement, string entrance) {
-    int direction = 0;
+/* replayRunner tracks the detections of the detection log of the stream as fast as the tracker goes. The frames keep
+   the mode they were recorded with, so only the tracker parameters change the outcome */
+void replayRunner(Stream* s) {
+    Size size = s->replay.size();
+    Rect roi = s->replay.roi();
+    long detections = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    DetectionRecord record;
+    const float* rows = NULL;
+    while (keepRunning.load() && s->replay.next(record, rows)) {
+        chrono::steady_clock::time_point busy = chrono::steady_clock::now();
+        s->captured++;
+        // Cars are counted at the time their frame was recorded
+        trackFrame(*s, (FrameMode)record.mode, rows, record.rows, size, roi, record.timestamp / 1000);
+        addStageTime(tracking_stats, 1, busy);
+        detections += record.rows;
+    }
 
-    // When movement is horizontal only consider trajectory along X axis
-    if (entrance.compare("l") == 0 || entrance.compare("r") == 0) {
-       direction = p.x - movement;
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << format("Replayed %ld frames with %ld detections of stream %s in %.3f s, %.0f detections/s",
+                   s->processed.load(), detections, s->name.c_str(), seconds,
+                   seconds > 0 ? detections / seconds : 0.0) << endl;
+    s->finished = true;
+}
+
+/* seekFrame moves cap, which is at the start of its video, to the given frame. With keyframe codecs a seek can land
+   on a frame next to the requested one, so the position is checked after the seek. When it doesn't match, the video
+   is opened again and decoded forward to the frame instead. Returns false when the video ends before the frame */
+bool seekFrame(VideoCapture& cap, const string& input, long frame) {
+    if (frame == 0) {
+        return true;
+    }
+    if (cap.set(CAP_PROP_POS_FRAMES, (double)frame) && (long)cap.get(CAP_PROP_POS_FRAMES) == frame) {
+        return true;
     }
-    // When movement is vertical only consider trajectory along Y axis
-    if (entrance.compare("b") == 0 || entrance.compare("t") == 0) {
-        direction = p.y - movement;
+    if (!cap.open(input)) {
+        return false;
+    }
+    for (long f = 0; f < frame; f++) {
+        if (!cap.grab()) {
+            return false;
+        }
     }
-    return direction;
+    return true;
 }
 
-// centroids2Cars iterates through all centroids and associates them with tracked_cars
-void centroids2Cars() {
-    // Iterate through updated centroids and update tracked car counts
-    for (map<int, Centroid>::iterator it = centroids.begin(); it != centroids.end(); ++it) {
-        int id = it->second.id;
-        Point p = it->second.p;
+/* countSegment runs the detector and the tracker of a segment of the video of the stream with its own capture and
+   network, and records the cars counted and the cars in view at the boundaries in result */
+bool countSegment(const Stream& s, Net& segment_net, SegmentResult& result) {
+    const Segment& seg = result.segment;
+    VideoCapture cap(s.input);
+    if (!cap.isOpened() || !seekFrame(cap, s.input, seg.first)) {
+        return false;
+    }
+    shared_ptr<const Settings> cfg = currentSettings();
+    CounterContext ctx;
+    initCounterContext(ctx, s.counter.entrance, cfg->max_distance, cfg->max_frames_gone);
+
+    Mat frame, blob, output;
+    BlobResizer resizer;
+    int since_detect = cfg->stride;
+    for (long f = seg.first; f < seg.last && !sig_caught; f++) {
+        if (!cap.read(frame) || frame.empty()) {
+            break;
+        }
+        Size size = frame.size();
+        Rect roi = frameRoi(s, size);
+        FrameMode mode = PREDICTED;
+        const float* rows = NULL;
+        size_t count = 0;
+        if (++since_detect >= cfg->stride) {
+            since_detect = 0;
+            mode = DETECTED;
+            resizer.batch(vector<Mat>(1, frame(roi)), blob, cfg->net_size);
+            segment_net.setInput(blob);
+            output = segment_net.forward();
+            rows = (const float*)output.data;
+            count = output.total() / 7;
+        }
+        trackDetections(ctx, mode, rows, count, size, roi, cfg->filter, cfg->stride);
 
-        Car car;
-        // If the centroid is not tracked yet, add it to tracked_cars
-        if (tracked_cars.find(id) == tracked_cars.end()) {
-            car.id = id;
-            car.traject.push_back(p);
-            car.counted = false;
-            car.gone = false;
-            car.direction = 0;
-        } 
-        else {
-            car = tracked_cars[id];
-            // Calculate mean movement from car trajectory
-            int movement = carMovement(car.traject, entrance);
-            // Add the centroid to the car trajectory
-            car.traject.push_back(p);
-            // Calculate car direction based on trajectory and current position
-            car.direction = carDirection(p, movement, entrance);
+        for (auto const& e: ctx.events) {
+            SegmentEvent event = {f, e};
+            result.events.push_back(event);
+        }
+        if (f == seg.start - 1) {
+            result.entry = segmentCars(ctx);
+        }
+        if (f == seg.end - 1) {
+            result.exit = segmentCars(ctx);
         }
-        tracked_cars[id] = car;
     }
+    return true;
 }
 
-// updateCarTotals iterates through all tracked cars and updates total counts both in and out of the parking
-void updateCarTotals() {
-    for (map<int, Car>::iterator it = tracked_cars.begin(); it != tracked_cars.end(); ++it) {
-        int id        = it->second.id;
-        int direction = it->second.direction;
-        bool gone     = it->second.gone;
-        bool counted  = it->second.counted;
+/* countSegments counts the cars of the video file of the stream in segments side by side, every thread with its own
+   network, and stitches the counts of the segments together into the counter of the stream */
+bool countSegments(Stream& s) {
+    long frames = (long)s.cap.get(CAP_PROP_FRAME_COUNT);
+    double fps = s.cap.get(CAP_PROP_FPS);
+    if (frames <= 0 || fps <= 0) {
+        cerr << "ERROR! Unable to get the length of video " << s.input << "\n";
+        return false;
+    }
+    vector<SegmentResult> results;
+    for (auto const& seg: planSegments(frames, segments, (long)(segment_overlap * fps))) {
+        SegmentResult result;
+        result.segment = seg;
+        results.push_back(result);
+    }
 
-        if (!counted) {
-            if (!gone) {
-                if (entrance.compare("t") == 0 || entrance.compare("l") == 0) {
-                    // Direction is "positive" i.e. movement along Y/X axis goes up
-                    if (direction > 0) {
-                        total_in++;
-                        it->second.counted = true;
-                    }
+    int threads = segment_threads > 0 ? segment_threads : (int)max(1u, thread::hardware_concurrency());
+    threads = min(threads, (int)results.size());
+    // Every segment gets a core of its own instead of sharing all of them
+    setNumThreads(1);
+    cout << "Counting " << frames << " frames of " << s.input << " in " << results.size() << " segments on "
+         << threads << " threads" << endl;
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    atomic<size_t> next(0);
+    atomic<bool> failed(false);
+    vector<thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.push_back(thread([&]() {
+            Net segment_net = readNet(model, config);
+            segment_net.setPreferableBackend(backendId);
+            segment_net.setPreferableTarget(targetId);
+            for (size_t k = next++; k < results.size() && !sig_caught; k = next++) {
+                if (!countSegment(s, segment_net, results[k])) {
+                    failed = true;
                 }
+            }
+        }));
+    }
+    for (auto& w: workers) {
+        w.join();
+    }
+    if (failed.load()) {
+        cerr << "ERROR! Unable to read up to a segment of video " << s.input << "\n";
+        return false;
+    }
+    if (sig_caught) {
+        cerr << "Counting interrupted\n";
+        return false;
+    }
 
-                if (entrance.compare("b") == 0 || entrance.compare("r") == 0) {
-                    // Direction is "negative" i.e. movement along Y/X axis goes down
-                    if (direction < 0) {
-                        total_in++;
-                        it->second.counted = true;
-                    }
-                }
-            } 
-            else {
-                if (entrance.compare("t") == 0 || entrance.compare("l") == 0) {
-                    // "Negative" direction i.e. car centroid coords along movement axis go down
-                    if (direction < 0) {
-                        total_out++;
-                        tracked_cars.erase(id);
-                    }
-                }
+    stitchSegments(results, currentSettings()->max_distance, s.counter.total_in, s.counter.total_out);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << format("Counted %ld frames in %.1f s, %.1f fps", frames, seconds, seconds > 0 ? frames / seconds : 0.0)
+         << endl;
+    return true;
+}
 
-                if (entrance.compare("b") == 0 || entrance.compare("r") == 0) {
-                    // "Positive" direction i.e. car centroid coords along movement axis go up
-                    if (direction > 0) {
-                        total_out++;
-                        tracked_cars.erase(id);
-                    }
-                }
-            }
-        } 
-        else {
-            if (gone) {
-                tracked_cars.erase(id);
-            }
-        }
+// isLiveInput returns true when the input is a camera device number or a network stream rather than a video file
+bool isLiveInput(const string& input) {
+    return (input.size() == 1 && input[0] >= '0' && input[0] <= '9') || input.find("://") != string::npos;
+}
+
+/* queueFrameLimit returns the number of frames the frame queue of the stream holds at most, or 0 when it is not
+   bounded. A cap in bytes is turned into frames using the frame size of the video source */
+size_t queueFrameLimit(Stream& s, QueuePolicy policy) {
+    if (policy == LATEST) {
+        return 1;
+    }
+    size_t limit = queue_frames;
+    size_t frame_bytes = (size_t)s.cap.get(CAP_PROP_FRAME_WIDTH) * (size_t)s.cap.get(CAP_PROP_FRAME_HEIGHT) * 3;
+    if (queue_bytes > 0 && frame_bytes > 0) {
+        // A single frame is always let in, even when it is larger than the cap
+        size_t by_size = max((size_t)1, queue_bytes / frame_bytes);
+        limit = limit == 0 ? by_size : min(limit, by_size);
     }
+    return limit;
 }
 
-// Function called by worker thread to process the next available video frame.
-void frameRunner() {
-    while (keepRunning.load()) {
-        Mat next = nextImageAvailable();
-        if (!next.empty()) {
-            // Convert to 4d vector as required by vehicle detection model and detect cars
-            blobFromImage(next, blob, 1.0, Size(672, 384));
-            net.setInput(blob);
-            Mat result = net.forward();
-
-            // Get detected cars and in and out counts
-            vector<Rect> frame_cars;
-            int count_in = 0;
-            int count_out = 0;
-            float* data = (float*)result.data;
-
-            for (size_t i = 0; i < result.total(); i += 7) {
-                int label = (int)data[i + 1];
-                float confidence = data[i + 2];
-                if (label == 1 && confidence > carconf) {
-                    int left = (int)(data[i + 3] * frame.cols);
-                    int top = (int)(data[i + 4] * frame.rows);
-                    int right = (int)(data[i + 5] * frame.cols);
-                    int bottom = (int)(data[i + 6] * frame.rows);
-                    int width = right - left + 1;
-                    int height = bottom - top + 1;
-                    
-                    // Check whether the detected object is going out of range of the frame  
-                    if(bottom >= next.rows) {
-                        height = next.rows - top;
-                    }
-                    frame_cars.push_back(Rect(left, top, width, height));
-                }
-            }
+// logPath returns the detection log file of the stream, with several inputs the stream name is appended to path
+string logPath(const string& path, const Stream& s, size_t count) {
+    return count == 1 ? path : path + "." + s.name;
+}
 
-            vector<Point> frame_centroids;
-            vector<Rect>  car_detections;
-            for(auto const& fc: frame_cars) {
-                // Make sure the car rect is completely inside the main Mat
-                if ((fc & Rect(0, 0, next.cols, next.rows)) != fc) {
-                    continue;
-                }
+// Function called by worker thread to read the video frames of the stream.
+void captureRunner(Stream* s) {
+    Backoff backoff;
+    while (keepRunning.load()) {
+        // Decode the frame into a pooled buffer, or wait for the pipeline to release one
+        chrono::steady_clock::time_point busy = chrono::steady_clock::now();
+        Mat frame;
+        if (!s->pool.read(s->cap, frame)) {
+            backoff.pause();
+            continue;
+        }
+        backoff.reset();
 
-                // Detected car rectangle dimensions
-                int width = fc.width;
-                int height = fc.height;
-                // If detected rectangle is too small, skip it
-                if (width < 70 || height < 70) {
-                    continue;
-                }
+        if (frame.empty()) {
+            cout << "Video Finished: " << s->name << endl;
+            break;
+        }
 
-                /* Sometimes detected car rectangle stretches way over the actual car dimensions
-                   so we clip the sizes of the rectangle to avoid skewing the centroid positions */
-                int w_clip = 200;
-                if (width > w_clip) {
-                    if ((fc.x + w_clip) < frame.cols) {
-                        width = w_clip;
-                    }
-                } 
-                else if ((fc.x + width) > frame.cols) {
-                    width = frame.cols - fc.x;
-                }
+        capture_latency.recordSince(busy);
 
-                int h_clip = 350;
-                if (height > h_clip) {
-                    if ((fc.y + h_clip) < frame.rows){
-                        height = h_clip;
-                    }
-                } 
-                else if ((fc.y + height) > frame.rows) {
-                    height = frame.rows - fc.y;
-                }
+        Frame next;
+        next.image = frame;
+        next.motion = !motion_gate || s->gate.update(frame);
+        addStageTime(capture_stats, 1, busy);
+        next.queued = chrono::steady_clock::now();
+        addImage(*s, next);
 
-                // Calculate detected car centroid coordinates
-                int x = fc.x + static_cast<int>(width/2.0);
-                int y = fc.y + static_cast<int>(height/2.0);
+        // In headless mode frames are read as fast as the pipeline takes them
+        if (headless) {
+            continue;
+        }
 
-                // Append detected centroid and draw rectangle
-                frame_centroids.push_back(Point(x,y));
-                car_detections.push_back(Rect(fc.x, fc.y, width, height));
-            }
+        s->m3.lock();
+        s->displayFrame = frame;
+        s->m3.unlock();
 
-            // Update tracked centroids using the centroids detected in the frame
-            updateCentroids(frame_centroids);
+        // Pace video files to their frame rate
+        this_thread::sleep_for(chrono::milliseconds(s->delay));
+    }
+    s->finished = true;
+}
 
-            // Associate centroids with tracked cars
-            centroids2Cars();
-            // Update tracked cars total counters
-            updateCarTotals();
-            // Update analytics and performance info
-            updateInfo();
-            savePerformanceInfo();
+/* publishUpdates publishes the cars counted since the last call in event mode, and the counts of every stream
+   when snapshot is set */
+void publishUpdates(bool snapshot) {
+    vector<StampedEvent> events;
+    for (auto& s: streams) {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        // The snapshot is read together with the events, so its totals count exactly the cars published so far
+        s->m4.lock();
+        InfoReader info = getCurrentInfo(*s);
+        events.swap(s->events);
+        s->m4.unlock();
+        if (!events.empty()) {
+            publishMQTTEvents(s->events_topic, events, *info);
+            events.clear();
+        }
+        if (snapshot) {
+            publishMQTTMessage(s->topic, *info);
         }
+        publish_latency.recordSince(start);
     }
-
-    cout << "Video processing thread stopped" << endl;
 }
 
-// Function called by worker thread to handle MQTT updates. Pauses for rate second(s) between updates.
+/* Function called by worker thread to handle MQTT updates. Pauses for rate second(s) between updates.
+   In event mode it publishes the counted cars every event_window milliseconds instead, and the counts
+   every heartbeat seconds only. Publishing only queues the messages, so a slow broker doesn't delay the updates */
 void messageRunner() {
+    chrono::steady_clock::time_point next_snapshot = chrono::steady_clock::now();
     while (keepRunning.load()) {
-        ParkingInfo info = getCurrentInfo();
-        publishMQTTMessage(topic, info);
-        this_thread::sleep_for(chrono::seconds(rate));
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        bool snapshot = !event_mode || now >= next_snapshot;
+        publishUpdates(snapshot);
+        if (snapshot) {
+            next_snapshot = now + chrono::seconds(heartbeat);
+        }
+        long pause = event_mode ? event_window : (long)(currentSettings()->rate * 1000);
+        this_thread::sleep_for(chrono::milliseconds(max(10L, pause)));
+    }
+    // Publish the cars counted since the last update before the connection closes
+    if (event_mode) {
+        publishUpdates(false);
     }
 
     cout << "MQTT sender thread stopped" << endl;
 }
 
+/* latencyWindow returns the number of values recorded by the histogram since the last call and their p50, p95 and
+   p99, given the bucket counts of the last call in last */
+json latencyWindow(const LatencyHistogram& histogram, vector<long>& last) {
+    vector<long> counts;
+    histogram.snapshot(counts);
+    vector<long> window = counts;
+    for (size_t b = 0; b < window.size() && b < last.size(); b++) {
+        window[b] -= last[b];
+    }
+    last = counts;
+
+    json latency;
+    latency["count"] = LatencyHistogram::total(window);
+    latency["p50_us"] = LatencyHistogram::percentile(window, 0.50);
+    latency["p95_us"] = LatencyHistogram::percentile(window, 0.95);
+    latency["p99_us"] = LatencyHistogram::percentile(window, 0.99);
+    return latency;
+}
+
+/* pipelineStats returns the statistics of the pipeline as a JSON object: the p50, p95 and p99 latency of every
+   step over the last interval, given the bucket counts of the previous call in last, and the queue depths and
+   frame counters of every stream and the MQTT publisher counters */
+json pipelineStats(vector<vector<long> >& last, double interval) {
+    json stats;
+    stats["time"] = (long long)chrono::duration_cast<chrono::seconds>(
+        chrono::system_clock::now().time_since_epoch()).count();
+    stats["interval"] = interval;
+
+    json steps;
+    size_t step_count = sizeof(step_latencies) / sizeof(step_latencies[0]);
+    last.resize(step_count);
+    for (size_t i = 0; i < step_count; i++) {
+        steps[step_latencies[i].name] = latencyWindow(*step_latencies[i].histogram, last[i]);
+    }
+    stats["steps"] = steps;
+
+    // The queue wait of every input follows the steps in last
+    last.resize(step_count + streams.size());
+    json inputs;
+    for (size_t i = 0; i < streams.size(); i++) {
+        Stream* s = streams[i].get();
+        json input;
+        input["frame_queue"] = (long)s->nextImage.size();
+        input["frame_queue_bytes"] = (long)s->nextImage.queuedBytes();
+        input["frame_queue_peak_bytes"] = (long)s->nextImage.peakBytes();
+        input["frame_queue_wait"] = latencyWindow(s->queueWait, last[step_count + i]);
+        input["detection_queue"] = (long)s->nextDetections.size();
+        input["captured"] = s->captured.load();
+        input["processed"] = s->processed.load();
+        input["idle"] = s->idle.load();
+        input["dropped"] = s->nextImage.dropped();
+        inputs[s->name] = input;
+    }
+    stats["inputs"] = inputs;
+
+    mqtt_publisher_stats published = mqtt_stats();
+    json mqtt;
+    mqtt["queued"] = published.queued;
+    mqtt["inflight"] = published.inflight;
+    mqtt["sent"] = published.sent;
+    mqtt["failed"] = published.failed;
+    mqtt["coalesced"] = published.coalesced;
+    mqtt["dropped"] = published.dropped;
+    mqtt["journaled"] = published.journaled;
+    stats["mqtt"] = mqtt;
+
+    if (replay_path.empty()) {
+        json startup;
+        startup["load_ms"] = load_ms;
+        startup["warmup_ms"] = warmup_ms;
+        long first = first_detection_ms.load();
+        startup["first_detection_ms"] = first < 0 ? json(nullptr) : json(first);
+        stats["startup"] = startup;
+    }
+    return stats;
+}
+
+/* Function called by worker thread to publish the pipeline statistics every stats_interval seconds, to the
+   stats MQTT topic and to the stats file */
+void statsRunner() {
+    ofstream file;
+    if (!stats_file.empty()) {
+        file.open(stats_file, ios::app);
+        if (!file) {
+            cerr << "ERROR! Unable to open stats file " << stats_file << "\n";
+        }
+    }
+
+    vector<vector<long> > last;
+    chrono::steady_clock::time_point previous = chrono::steady_clock::now();
+    chrono::steady_clock::time_point next = previous + chrono::seconds(stats_interval);
+    while (keepRunning.load()) {
+        // Sleep in short steps, so the thread stops quickly at the end of the run
+        if (chrono::steady_clock::now() < next) {
+            this_thread::sleep_for(chrono::milliseconds(100));
+            continue;
+        }
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        string payload = pipelineStats(last, chrono::duration<double>(now - previous).count()).dump();
+        previous = now;
+        next = now + chrono::seconds(stats_interval);
+
+        mqtt_publish(stats_topic, payload);
+        if (file.is_open()) {
+            file << payload << endl;
+        }
+    }
+
+    cout << "Statistics thread stopped" << endl;
+}
+
+// printThroughput prints the frame rate of every stream and the aggregate frame rate of all of them
+void printThroughput(const vector<long>& processed, double seconds) {
+    if (seconds <= 0) {
+        return;
+    }
+
+    long total = 0;
+    ostringstream s;
+    for (size_t i = 0; i < streams.size(); i++) {
+        total += processed[i];
+        s << " " << streams[i]->name << ": " << format("%.1f", processed[i] / seconds);
+    }
+    if (motion_gate) {
+        // Share of the frames which skipped the detector for lack of motion, since the start
+        s << " | Motion skip ratio:";
+        for (auto& st: streams) {
+            long frames = st->processed.load();
+            s << " " << st->name << ": " << format("%.2f", frames > 0 ? (double)st->idle.load() / frames : 0.0);
+        }
+    }
+    cout << "Streams: " << streams.size() << " Aggregate FPS: " << format("%.1f", total / seconds)
+         << " |" << s.str() << endl;
+
+    // Frame buffer allocations are counted since the start, steady state should not add any
+    long allocations = 0;
+    long frames = 0;
+    for (auto& st: streams) {
+        allocations += st->pool.allocations();
+        frames += st->pool.frames();
+    }
+    cout << "Frame buffer allocations: " << allocations << " Allocations per frame: "
+         << format("%.4f", frames > 0 ? (double)allocations / frames : 0.0) << endl;
+}
+
+/* printStageSummary prints the frames handled by every pipeline stage and the time it was busy with them.
+   Busy time is summed over the threads of a stage, so the capture and tracking stages of several inputs
+   can be busy for longer than the run lasted */
+void printStageSummary(double seconds) {
+    StageStats* stages[] = {&capture_stats, &inference_stats, &tracking_stats};
+    for (StageStats* stats: stages) {
+        double busy = stats->busy_us.load() / 1e6;
+        long frames = stats->frames.load();
+        cout << format("%-10s frames: %8ld busy: %8.2f s  %8.1f frames/busy s  %6.1f %% of run",
+                       stats->name, frames, busy, busy > 0 ? frames / busy : 0.0,
+                       seconds > 0 ? 100 * busy / seconds : 0.0) << endl;
+    }
+}
+
+// displayStream shows the latest captured frame of the stream with the analytics info drawn on it
+void displayStream(Stream& s) {
+    Mat frame;
+    s.m3.lock();
+    swap(frame, s.displayFrame);
+    s.m3.unlock();
+    if (frame.empty()) {
+        return;
+    }
+
+    /* Draw on a copy, the captured frame is a pooled buffer which may still be waiting for inference.
+       copyTo reuses the overlay buffer, so this does not allocate once the first frame is shown */
+    frame.copyTo(s.overlay);
+    frame = s.overlay;
+
+    // Print Inference Engine performance info
+    string label = getCurrentPerf();
+    putText(frame, label, Point(0, 25), FONT_HERSHEY_SIMPLEX, 0.5, CV_RGB(255, 255, 255));
+
+    InfoReader info = getCurrentInfo(s);
+    label = format("Cars In: %d Cars Out: %d", info->total_in, info->total_out);
+    putText(frame, label, Point(0, 45), FONT_HERSHEY_SIMPLEX, 0.5, CV_RGB(255, 255, 255));
+    // Draw car centroids
+    for (const Centroid& c: info->centroids) {
+        circle(frame, c.p, 5.0, CV_RGB(0, 255, 0), 2);
+        label = format("[%d, %d]", c.p.x, c.p.y);
+        putText(frame, label, Point(c.p.x+5, c.p.y),
+                        FONT_HERSHEY_SIMPLEX, 0.5, CV_RGB(0, 255, 0));
+    }
+
+    imshow(streams.size() == 1 ? "Parking Lot Counter" : "Parking Lot Counter - " + s.name, frame);
+}
+
 // Signal handler for the main thread
 void handle_sigterm(int signum)
 {
-    // We only handle SIGTERM and SIGKILL here
-    if (signum == SIGTERM) {
+    // We only handle SIGTERM and SIGINT here
+    if (signum == SIGTERM || signum == SIGINT) {
         cout << "Interrupt signal (" << signum << ") received" << endl;
         sig_caught = 1;
     }
@@ -593,11 +1410,11 @@ void handle_sigterm(int signum)
 
 int main(int argc, char** argv)
 {
-    std::string conf_file = "../resources/config.json", input;
+    started_at = chrono::steady_clock::now();
+    std::string conf_file = "../resources/config.json";
     std::ifstream confFile(conf_file);
     confFile>>jsonobj;
     auto obj = jsonobj["inputs"];
-    input = obj[0]["video"];
 
     // Parse command line arguments
     CommandLineParser parser(argc, argv, keys);
@@ -610,90 +1427,340 @@ int main(int argc, char** argv)
 
     model = parser.get<String>("model");
     config = parser.get<String>("config");
-    carconf = parser.get<float>("carconf");
+    Settings initial;
+    initial.filter.confidence = parser.get<float>("carconf");
+    initial.filter.min_size = parser.get<int>("min_car_size");
+    initial.filter.clip_width = parser.get<int>("clip_width");
+    initial.filter.clip_height = parser.get<int>("clip_height");
     backendId = parser.get<int>("backend");
     targetId = parser.get<int>("target");
     entrance = parser.get<string>("entrance");
-    rate = parser.get<int>("rate");
-    max_distance = parser.get<int>("max_distance");
-    max_frames_gone = parser.get<int>("max_frames_gone");
+    initial.rate = parser.get<double>("rate");
+    event_mode = parser.get<bool>("events");
+    event_window = parser.get<int>("event_window");
+    heartbeat = max(1, parser.get<int>("heartbeat"));
+    log_every = parser.get<int>("log_every");
+    PayloadFormat payload_format;
+    if (!parsePayloadFormat(parser.get<string>("payload"), payload_format)) {
+        cerr << "ERROR! Unknown payload encoding " << parser.get<string>("payload") << "\n";
+        return -1;
+    }
+    encoder = PayloadEncoder(payload_format);
+    initial.max_distance = parser.get<int>("max_distance");
+    initial.max_frames_gone = parser.get<int>("max_frames_gone");
+    max_streams = parser.get<int>("streams");
+    batch_size = max(1, parser.get<int>("batch"));
+    batch_wait = parser.get<int>("batch_wait");
+    pool_size = max(1, parser.get<int>("pool"));
+    infer_requests = max(1, parser.get<int>("requests"));
+    initial.stride = max(1, parser.get<int>("stride"));
+    adaptive_stride = parser.get<bool>("adaptive_stride");
+    motion_gate = parser.get<bool>("motion_gate");
+    motion_band = parser.get<double>("motion_band");
+    string size_error;
+    if (!parseInputSize(parser.get<string>("input_size"), initial.net_size, size_error)) {
+        cerr << "ERROR! Invalid network input size " << parser.get<string>("input_size") << ", " << size_error << "\n";
+        return -1;
+    }
+    atomic_store(&settings, shared_ptr<const Settings>(make_shared<Settings>(initial)));
+    headless = parser.get<bool>("headless");
+    auto_queue_policy = parser.get<string>("queue_policy") == "auto";
+    if (!auto_queue_policy && !parseQueuePolicy(parser.get<string>("queue_policy"), queue_policy)) {
+        cerr << "ERROR! Unknown queue policy " << parser.get<string>("queue_policy") << "\n";
+        return -1;
+    }
+    queue_frames = max(0, parser.get<int>("queue_frames"));
+    queue_bytes = (size_t)max(0, parser.get<int>("queue_mb")) << 20;
+    segments = max(0, parser.get<int>("segments"));
+    segment_overlap = max(0.0, parser.get<double>("overlap"));
+    segment_threads = max(0, parser.get<int>("segment_threads"));
+    stats_interval = parser.get<int>("stats_interval");
+    stats_file = parser.get<string>("stats_file");
+    net_cache = parser.get<string>("net_cache");
+    warmup_runs = max(0, parser.get<int>("warmup"));
+    record_path = parser.get<string>("record");
+    replay_path = parser.get<string>("replay");
+    // There are no video frames to display in replay mode
+    if (!replay_path.empty()) {
+        headless = true;
+    }
 
     // Connect MQTT messaging
     int result = mqtt_start(handleMQTTControlMessages);
     if (result == 0) {
         syslog(LOG_INFO, "MQTT started.");
+        string journal = parser.get<string>("journal");
+        size_t journal_size = (size_t)max(1, parser.get<int>("journal_size")) << 20;
+        if (!journal.empty() && !mqtt_journal(journal, journal_size)) {
+            cerr << "ERROR! Unable to open MQTT journal " << journal << "\n";
+            return -1;
+        }
     } else {
         syslog(LOG_INFO, "MQTT NOT started: have you set the ENV varables?");
     }
 
+    mqtt_subscribe(control_topic);
     mqtt_connect();
 
-    // Read in car detection model
-    net = readNet(model, config);
-    net.setPreferableBackend(backendId);
-    net.setPreferableTarget(targetId);
+    // The compile caches are set up for the segment networks too
+    if (replay_path.empty() && !net_cache.empty() && useNetworkCache(net_cache, backendId, targetId).empty()) {
+        cerr << "ERROR! Unable to create network cache directory " << net_cache << "\n";
+        return -1;
+    }
+    // Read in car detection model, it is shared by all the streams. Replay doesn't run the detector, segments run
+    // networks of their own
+    if (replay_path.empty() && segments == 0) {
+        chrono::steady_clock::time_point loading = chrono::steady_clock::now();
+        net = readNet(model, config);
+        net.setPreferableBackend(backendId);
+        net.setPreferableTarget(targetId);
+        load_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - loading).count();
+
+        // The first forward pass compiles the network for the target, which is done before the capture starts
+        cout << format("Network read in %.0f ms", load_ms) << endl;
+        if (warmup_runs > 0) {
+            chrono::steady_clock::time_point warming = chrono::steady_clock::now();
+            double first_run_ms = warmUpNetwork(net, batch_size, initial.net_size, warmup_runs);
+            warmup_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - warming).count();
+            cout << format("Network warmed up by %d runs in %.0f ms, the first one in %.0f ms",
+                           warmup_runs, warmup_ms, first_run_ms) << endl;
+        }
+    }
 
-    // open video capture source
-    if (input.size() == 1 && *(input.c_str()) >= '0' && *(input.c_str()) <= '9')
-        cap.open(std::stoi(input));
-    else
-    {
-        cap.open(input);
-        double fps = cap.get(CAP_PROP_FPS);
-        delay = 1000/fps;
+    // open video capture source of every configured input
+    size_t count = obj.size();
+    if (max_streams > 0 && (size_t)max_streams < count) {
+        count = max_streams;
     }
-    if (!cap.isOpened()) {
-        cerr << "ERROR! Unable to open video source\n";
+    for (size_t i = 0; i < count; i++) {
+        unique_ptr<Stream> s(new Stream(pool_size));
+        string input = obj[i]["video"];
+        s->input = input;
+        s->name = obj[i].count("name") ? obj[i]["name"].get<string>() : to_string(i);
+        // A single unnamed input keeps publishing to the base topic
+        s->topic = (count == 1 && !obj[i].count("name")) ? topic : topic + "/" + s->name;
+        s->events_topic = s->topic + "/events";
+        initCounterContext(s->counter,
+                           obj[i].count("entrance") ? obj[i]["entrance"].get<string>() : entrance,
+                           initial.max_distance, initial.max_frames_gone);
+        resetInfo(*s);
+        s->finished = false;
+        s->captured = 0;
+        s->processed = 0;
+        s->evicted = 0;
+        s->idle = 0;
+        // Motion of half a percent of the band pixels opens the gate, which then stays open for 15 frames
+        s->gate.init(s->counter.entrance, motion_band, 0.005, 15);
+        s->stride = initial.stride;
+        s->roi_band = 0;
+        if (obj[i].count("roi")) {
+            const json& roi = obj[i]["roi"];
+            if (roi.is_string() && roi.get<string>() == "entrance") {
+                // "entrance" selects the band along the entrance edge
+                s->roi_band = obj[i].count("roi_band") ? obj[i]["roi_band"].get<double>() : 0.5;
+                if (!(s->roi_band > 0 && s->roi_band <= 1)) {
+                    cerr << "ERROR! The roi_band of input " << s->name << " must be between 0 and 1\n";
+                    return -1;
+                }
+            } else if (roi.is_array() && roi.size() == 4 && roi[0].is_number_integer() &&
+                       roi[1].is_number_integer() && roi[2].is_number_integer() && roi[3].is_number_integer()) {
+                s->roi = Rect(roi[0].get<int>(), roi[1].get<int>(), roi[2].get<int>(), roi[3].get<int>());
+            } else {
+                cerr << "ERROR! Unknown roi " << roi.dump() << " of input " << s->name
+                     << ", it must be \"entrance\" or [x, y, width, height]\n";
+                return -1;
+            }
+        }
+        // A live source keeps its latest frames, a video file waits for the inference so no frame is lost
+        QueuePolicy policy = auto_queue_policy ? (isLiveInput(input) ? DROP_OLDEST : BLOCK) : queue_policy;
+        if (obj[i].count("queue_policy") && !parseQueuePolicy(obj[i]["queue_policy"].get<string>(), policy)) {
+            cerr << "ERROR! Unknown queue policy of input " << s->name << "\n";
+            return -1;
+        }
+        s->nextImage.configure(queue_frames, queue_bytes, policy);
+        // The first frame of every stream goes through the detector
+        s->since_detect = initial.stride;
+        s->delay = 5;
+
+        if (!replay_path.empty()) {
+            string path = logPath(replay_path, *s, count);
+            if (!s->replay.open(path) || s->replay.header().row_size != 7) {
+                cerr << "ERROR! Unable to read detection log " << path << "\n";
+                return -1;
+            }
+            streams.push_back(std::move(s));
+            continue;
+        }
+        if (!record_path.empty()) {
+            string path = logPath(record_path, *s, count);
+            if (!s->recorder.open(path)) {
+                cerr << "ERROR! Unable to create detection log " << path << "\n";
+                return -1;
+            }
+        }
+
+        if (input.size() == 1 && *(input.c_str()) >= '0' && *(input.c_str()) <= '9')
+            s->cap.open(std::stoi(input));
+        else
+        {
+            s->cap.open(input);
+            double fps = s->cap.get(CAP_PROP_FPS);
+            s->delay = 1000/fps;
+        }
+        if (!s->cap.isOpened()) {
+            cerr << "ERROR! Unable to open video source " << input << "\n";
+            return -1;
+        }
+        /* Every queued frame, every frame of the batch being collected and the frame waiting to be displayed hold
+           a pooled buffer. When the queue can hold as many frames as the rest of the pool, the capture waits for
+           a buffer before the queue is ever full, so a dropping policy would never drop anything */
+        size_t held = queueFrameLimit(*s, policy);
+        if (policy != BLOCK && (held == 0 || held + batch_size + (headless ? 0 : 1) >= (size_t)pool_size)) {
+            cerr << "ERROR! The frame queue of input " << s->name << " must hold fewer frames than -pool minus "
+                 << "-batch, and one more in display mode, for its queue policy to drop frames\n";
+            return -1;
+        }
+        streams.push_back(std::move(s));
+    }
+    if (streams.empty()) {
+        cerr << "ERROR! No inputs found in " << conf_file << "\n";
         return -1;
     }
 
     // Register SIGTERM signal handler
     signal(SIGTERM, handle_sigterm);
+    // Without a window there is no ESC key to stop the application
+    if (headless || segments > 0) {
+        signal(SIGINT, handle_sigterm);
+    }
+
+    // Archived footage is counted in segments without the live pipeline
+    if (segments > 0) {
+        Stream& s = *streams[0];
+        if (streams.size() != 1 || !replay_path.empty() || isLiveInput(s.input)) {
+            cerr << "ERROR! Segments need a single video file input\n";
+            return -1;
+        }
+        if (!countSegments(s)) {
+            return -1;
+        }
+        updateInfo(s);
+        publishMQTTMessage(s.topic, *getCurrentInfo(s));
+        cout << "Stream " << s.name << " Cars In: " << s.counter.total_in << " Cars Out: " << s.counter.total_out
+             << endl;
+        mqtt_disconnect();
+        mqtt_close();
+        return 0;
+    }
 
     // Start worker threads
-    thread t1(frameRunner);
+    vector<thread> workers;
+    thread t1;
+    for (auto& s: streams) {
+        if (!replay_path.empty()) {
+            workers.push_back(thread(replayRunner, s.get()));
+            continue;
+        }
+        workers.push_back(thread(captureRunner, s.get()));
+        workers.push_back(thread(frameRunner, s.get()));
+    }
+    if (replay_path.empty()) {
+        t1 = thread(inferenceRunner);
+    }
     thread t2(messageRunner);
+    thread t3;
+    if (stats_interval > 0) {
+        t3 = thread(statsRunner);
+    }
+
+    int delay = streams[0]->delay;
+    for (auto& s: streams) {
+        delay = min(delay, s->delay);
+    }
 
-    // Read video input data
+    // Throughput is reported every report_interval seconds
+    const double report_interval = 5.0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    chrono::steady_clock::time_point last_report = start;
+    vector<long> last_processed(streams.size(), 0);
+
+    // Display video input data
     for (;;) {
-        cap.read(frame);
+        // The run is finished once every captured frame of every input has been tracked
+        bool finished = true;
+        for (auto& s: streams) {
+            finished = finished && s->finished.load() &&
+                       s->processed.load() + s->evicted.load() == s->captured.load();
+            if (!headless) {
+                displayStream(*s);
+            }
+        }
 
-        if (frame.empty()) {
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        double elapsed = chrono::duration<double>(now - last_report).count();
+        if (elapsed >= report_interval) {
+            vector<long> processed(streams.size());
+            for (size_t i = 0; i < streams.size(); i++) {
+                processed[i] = streams[i]->processed.load();
+                long current = processed[i];
+                processed[i] -= last_processed[i];
+                last_processed[i] = current;
+            }
+            printThroughput(processed, elapsed);
+            last_report = now;
+        }
+
+        if (finished) {
             keepRunning = false;
             cout << "Video Finished\n";
             break;
         }
 
-        addImage(frame);
-
-        // Print Inference Engine performance info
-        string label = getCurrentPerf();
-        putText(frame, label, Point(0, 25), FONT_HERSHEY_SIMPLEX, 0.5, CV_RGB(255, 255, 255));
-
-        ParkingInfo info = getCurrentInfo();
-        label = format("Cars In: %d Cars Out: %d", info.total_in, info.total_out);
-        putText(frame, label, Point(0, 45), FONT_HERSHEY_SIMPLEX, 0.5, CV_RGB(255, 255, 255));
-        // Draw car centroids
-        for (map<int, Centroid>::const_iterator it = info.centroids.begin(); it != info.centroids.end(); ++it) {
-            circle(frame, it->second.p, 5.0, CV_RGB(0, 255, 0), 2);
-            label = format("[%d, %d]", it->second.p.x, it->second.p.y);
-            putText(frame, label, Point(it->second.p.x+5, it->second.p.y),
-                            FONT_HERSHEY_SIMPLEX, 0.5, CV_RGB(0, 255, 0));
+        if (headless) {
+            this_thread::sleep_for(chrono::milliseconds(50));
         }
-
-        imshow("Parking Lot Counter", frame);
-
-        if (waitKey(delay) >= 27 || sig_caught) {
+        if ((!headless && waitKey(delay) >= 27) || sig_caught) {
             cout << "Attempting to stop background threads" << endl;
             keepRunning = false;
             break;
         }
     }
 
+    // Wake up the capture threads waiting for room in their frame queue
+    for (auto& s: streams) {
+        s->nextImage.close();
+    }
+
     // Wait for the threads to finish
-    t1.join();
+    for (auto& w: workers) {
+        w.join();
+    }
+    if (t1.joinable()) {
+        t1.join();
+    }
     t2.join();
-    cap.release();
+    if (t3.joinable()) {
+        t3.join();
+    }
+
+    // Report the throughput of the whole run
+    vector<long> processed(streams.size());
+    for (size_t i = 0; i < streams.size(); i++) {
+        processed[i] = streams[i]->processed.load();
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "Total throughput" << endl;
+    printThroughput(processed, seconds);
+    printStageSummary(seconds);
+    // Report the final counts, e.g. to compare runs with different detection strides
+    for (auto& s: streams) {
+        InfoReader info = getCurrentInfo(*s);
+        cout << "Stream " << s->name << " Cars In: " << info->total_in << " Cars Out: " << info->total_out << endl;
+    }
+    for (auto& s: streams) {
+        s->cap.release();
+        s->recorder.close();
+    }
 
     // Disconnect MQTT messaging
     mqtt_disconnect();
@@ -0,0 +1,98 @@
+/*
+* Copyright (c) 2018 Intel Corporation.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "metrics.h"
+
+using namespace std;
+
+const int LatencyHistogram::linear;
+const int LatencyHistogram::sub_buckets;
+const int LatencyHistogram::bucket_count;
+
+LatencyHistogram::LatencyHistogram() {
+    for (int i = 0; i < bucket_count; i++) {
+        buckets[i] = 0;
+    }
+}
+
+/* bucketOf returns the bucket of a duration. Past the linear range, the bucket is given by the position of
+   the highest bit of the duration and the 3 bits below it */
+int LatencyHistogram::bucketOf(long us) {
+    if (us < linear) {
+        return us < 0 ? 0 : (int)us;
+    }
+    int exponent = 63 - __builtin_clzl((unsigned long)us);
+    int sub = (int)((us >> (exponent - 3)) & (sub_buckets - 1));
+    int bucket = linear + (exponent - 4) * sub_buckets + sub;
+    return bucket < bucket_count ? bucket : bucket_count - 1;
+}
+
+long LatencyHistogram::bucketLimit(int bucket) {
+    if (bucket < linear) {
+        return bucket;
+    }
+    int exponent = 4 + (bucket - linear) / sub_buckets;
+    long sub = (bucket - linear) % sub_buckets;
+    return ((sub_buckets + sub + 1) << (exponent - 3)) - 1;
+}
+
+void LatencyHistogram::record(long us) {
+    buckets[bucketOf(us)].fetch_add(1, memory_order_relaxed);
+}
+
+void LatencyHistogram::recordSince(chrono::steady_clock::time_point start) {
+    record(chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count());
+}
+
+void LatencyHistogram::snapshot(vector<long>& counts) const {
+    counts.resize(bucket_count);
+    for (int i = 0; i < bucket_count; i++) {
+        counts[i] = buckets[i].load(memory_order_relaxed);
+    }
+}
+
+long LatencyHistogram::total(const vector<long>& counts) {
+    long n = 0;
+    for (long c: counts) {
+        n += c;
+    }
+    return n;
+}
+
+long LatencyHistogram::percentile(const vector<long>& counts, double q) {
+    long n = total(counts);
+    if (n == 0) {
+        return 0;
+    }
+    // rank is the number of durations which have to be at most the percentile
+    long rank = (long)(q * n + 0.5);
+    rank = rank < 1 ? 1 : rank;
+    long seen = 0;
+    for (size_t i = 0; i < counts.size(); i++) {
+        seen += counts[i];
+        if (seen >= rank) {
+            return bucketLimit((int)i);
+        }
+    }
+    return bucketLimit((int)counts.size() - 1);
+}
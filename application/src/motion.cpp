@@ -0,0 +1,67 @@
+/*
+* Copyright (c) 2018 Intel Corporation.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <opencv2/imgproc.hpp>
+
+#include "motion.h"
+#include "tracker.h"
+
+using namespace std;
+using namespace cv;
+
+// Width in pixels of the downscaled frame the motion is detected in
+static const int motion_width = 160;
+// Minimum change of a pixel value to count the pixel as changed
+static const int pixel_threshold = 25;
+
+MotionGate::MotionGate() : band(1.0), changed_ratio(0), hold(0), since_motion(0) {}
+
+void MotionGate::init(const string& entrance, double band, double threshold, int hold) {
+    this->entrance = entrance;
+    this->band = min(max(band, 0.0), 1.0);
+    changed_ratio = threshold;
+    this->hold = hold;
+    // The first frame always goes through the detector
+    since_motion = 0;
+    prev.release();
+}
+
+bool MotionGate::update(const Mat& frame) {
+    int height = max(1, frame.rows * motion_width / max(1, frame.cols));
+    resize(frame, small, Size(motion_width, height), 0, 0, INTER_NEAREST);
+    cvtColor(small(entranceBand(small.size(), entrance, band)), gray, COLOR_BGR2GRAY);
+
+    bool motion = true;
+    if (prev.size() == gray.size()) {
+        absdiff(gray, prev, diff);
+        cv::threshold(diff, diff, pixel_threshold, 255, THRESH_BINARY);
+        motion = countNonZero(diff) > changed_ratio * diff.total();
+    }
+    gray.copyTo(prev);
+
+    if (motion) {
+        since_motion = 0;
+        return true;
+    }
+    return ++since_motion <= hold;
+}
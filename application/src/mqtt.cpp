@@ -21,14 +21,70 @@
 * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 */
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
 #include "mqtt.h"
+#include "journal.h"
+
+/* Messages are published asynchronously. mqtt_publish only adds the message to a bounded outbound queue, from where
+   up to MQTT_MAX_INFLIGHT messages at a time are handed to the Paho async client. Whenever one of them is
+   acknowledged or fails, the next ones are sent from the Paho callback thread. A message replaces the message for
+   the same topic which is still waiting in the queue, so a slow broker gets the latest snapshot of every topic
+   rather than a backlog of stale ones. While the client is disconnected the messages wait in the queue, and the
+   connection is retried with an exponential backoff. So neither a slow nor a missing broker blocks the caller.
+   With a journal, the messages published while the client is disconnected are appended to the journal file
+   instead, and once the connection is back they are taken from it in batches whenever the queue runs empty.
+   Until the journal is drained, new messages go to its end, so the messages are still sent in order.
+   A message travels with its send request and goes back to the front of the queue when the send fails, for example
+   when the connection is lost with messages in flight. A journaled message stays in the journal until the broker
+   acknowledged it, so not even a crash loses it. At shutdown, the messages still waiting for an acknowledgement
+   are written to the journal together with the queued ones */
 
 bool mqtt_initialized = false;
-MQTTClient client;
-MQTTClient_connectOptions conn_opts = MQTTClient_connectOptions_initializer;
-MQTTClient_message pubmsg = MQTTClient_message_initializer;
-MQTTClient_deliveryToken token;
-MQTTClient_SSLOptions sslOptions = MQTTClient_SSLOptions_initializer;
+MQTTAsync client;
+MQTTAsync_connectOptions conn_opts = MQTTAsync_connectOptions_initializer;
+MQTTAsync_SSLOptions sslOptions = MQTTAsync_SSLOptions_initializer;
+// mqtt_config holds the strings conn_opts and sslOptions point to
+mqtt_service_config mqtt_config;
+
+struct mqtt_outbound_message
+{
+    std::string topic;
+    std::string payload;
+    bool coalesce;
+    // journal_end identifies a message taken from the journal to acknowledge it, it is 0 for the other messages
+    uint64_t journal_end;
+};
+
+// mqtt_mutex guards the outbound queue, the journal, the subscriptions, the connection state and the statistics
+std::mutex mqtt_mutex;
+std::deque<mqtt_outbound_message> outbound;
+// sending holds the messages handed to the client which are waiting for their callback, in the order they were sent
+std::deque<mqtt_outbound_message*> sending;
+MessageJournal journal;
+std::vector<std::string> subscriptions;
+bool connected = false;
+bool connecting = false;
+// closing is set once the client is about to be disconnected, it keeps the client from connecting and sending again
+bool closing = false;
+// retry_at is the earliest time of the next connection attempt, retry_delay doubles with every failed attempt
+std::chrono::steady_clock::time_point retry_at;
+std::chrono::seconds retry_delay(1);
+const std::chrono::seconds max_retry_delay(60);
+mqtt_publisher_stats stats = {0, 0, 0, 0, 0, 0, 0};
+/* Only one thread at a time sends queued messages, the one which set pumping. A thread finding it set leaves a
+   request in pump_requested instead, which the sending thread picks up before it lets go */
+std::atomic<bool> pumping(false);
+std::atomic<bool> pump_requested(false);
+// connector retries the connection and drains the journal in the background while keep_connecting is set
+std::thread connector;
+std::atomic<bool> keep_connecting(false);
 
 std::string std_getenv(const std::string &name)
 {
@@ -36,74 +92,252 @@ std::string std_getenv(const std::string &name)
     return value != nullptr ? std::string(value) : std::string();
 }
 
+static void mqtt_pump();
+
+// mqtt_sent removes a message from the messages waiting for their callback. mqtt_mutex must be held
+static void mqtt_sent(mqtt_outbound_message* msg)
+{
+    sending.erase(std::find(sending.begin(), sending.end(), msg));
+    stats.inflight--;
+}
+
+// mqtt_acknowledge removes a message taken from the journal for good. mqtt_mutex must be held
+static void mqtt_acknowledge(mqtt_outbound_message const &msg)
+{
+    if (msg.journal_end != 0 && journal.isOpen())
+    {
+        journal.acknowledge(msg.journal_end);
+    }
+}
+
+/* mqtt_requeue puts a message which could not be sent back to the front of the queue, unless a newer message of
+   the topic replaces it already. mqtt_mutex must be held */
+static void mqtt_requeue(mqtt_outbound_message &msg)
+{
+    if (msg.coalesce)
+    {
+        for (auto const &queued: outbound)
+        {
+            if (queued.coalesce && queued.topic == msg.topic)
+            {
+                stats.coalesced++;
+                mqtt_acknowledge(msg);
+                return;
+            }
+        }
+    }
+    outbound.push_front(std::move(msg));
+    stats.queued++;
+}
+
+// The context of a send request is the message, which the callbacks take over
+static void on_send_success(void* context, MQTTAsync_successData* response)
+{
+    mqtt_outbound_message* msg = (mqtt_outbound_message*)context;
+    {
+        std::lock_guard<std::mutex> lock(mqtt_mutex);
+        mqtt_sent(msg);
+        stats.sent++;
+        mqtt_acknowledge(*msg);
+    }
+    delete msg;
+    mqtt_pump();
+}
+
+static void on_send_failure(void* context, MQTTAsync_failureData* response)
+{
+    mqtt_outbound_message* msg = (mqtt_outbound_message*)context;
+    {
+        std::lock_guard<std::mutex> lock(mqtt_mutex);
+        mqtt_sent(msg);
+        stats.failed++;
+        mqtt_requeue(*msg);
+    }
+    delete msg;
+    mqtt_pump();
+}
+
+/* mqtt_refill moves the next batch of journaled messages to the empty outbound queue and returns false when there
+   is none. mqtt_mutex must be held */
+static bool mqtt_refill()
+{
+    if (!journal.isOpen() || journal.empty())
+    {
+        return false;
+    }
+    std::vector<JournalMessage> batch;
+    journal.take(batch, MQTT_JOURNAL_BATCH);
+    for (auto &message: batch)
+    {
+        mqtt_outbound_message msg = {std::move(message.topic), std::move(message.payload), message.coalesce,
+                                     message.end};
+        outbound.push_back(std::move(msg));
+    }
+    stats.queued += batch.size();
+    stats.journaled = journal.size();
+    return !batch.empty();
+}
+
+// mqtt_send_queued sends queued messages until the in-flight window is full, the caller must own pumping
+static void mqtt_send_queued()
+{
+    for (;;)
+    {
+        mqtt_outbound_message* msg;
+        {
+            std::lock_guard<std::mutex> lock(mqtt_mutex);
+            if (!connected || stats.inflight >= MQTT_MAX_INFLIGHT || (outbound.empty() && !mqtt_refill()))
+            {
+                return;
+            }
+            msg = new mqtt_outbound_message(std::move(outbound.front()));
+            outbound.pop_front();
+            stats.queued--;
+            stats.inflight++;
+            sending.push_back(msg);
+        }
+
+        // The client copies the topic and the payload, the message itself is kept until the send completes
+        MQTTAsync_message pubmsg = MQTTAsync_message_initializer;
+        pubmsg.payload = (void*)msg->payload.data();
+        pubmsg.payloadlen = (int)msg->payload.size();
+        pubmsg.qos = QOS;
+        pubmsg.retained = 0;
+        MQTTAsync_responseOptions opts = MQTTAsync_responseOptions_initializer;
+        opts.onSuccess = on_send_success;
+        opts.onFailure = on_send_failure;
+        opts.context = msg;
+        int rc = MQTTAsync_sendMessage(client, msg->topic.c_str(), &pubmsg, &opts);
+        if (rc != MQTTASYNC_SUCCESS)
+        {
+            // The callbacks are only called for a message the client accepted
+            std::lock_guard<std::mutex> lock(mqtt_mutex);
+            mqtt_sent(msg);
+            if (rc == MQTTASYNC_DISCONNECTED)
+            {
+                // Keep the message for when the connection is back
+                connected = false;
+                mqtt_requeue(*msg);
+                delete msg;
+                return;
+            }
+            stats.failed++;
+            mqtt_acknowledge(*msg);
+            delete msg;
+        }
+    }
+}
+
+/* mqtt_pump sends queued messages until the in-flight window is full. It is called from the publishing thread,
+   the connector thread and the client callbacks, and serializes them, so the messages are sent in queue order */
+static void mqtt_pump()
+{
+    pump_requested = true;
+    while (pump_requested.load() && !pumping.exchange(true))
+    {
+        pump_requested = false;
+        mqtt_send_queued();
+        pumping = false;
+    }
+}
+
+static void on_connected(void* context, char* cause)
+{
+    std::vector<std::string> topics;
+    {
+        std::lock_guard<std::mutex> lock(mqtt_mutex);
+        connecting = false;
+        if (closing)
+        {
+            return;
+        }
+        connected = true;
+        retry_delay = std::chrono::seconds(1);
+        topics = subscriptions;
+    }
+    // Subscriptions don't survive a clean session, so they are renewed on every connect
+    for (auto const &topic: topics)
+    {
+        MQTTAsync_subscribe(client, topic.c_str(), QOS, NULL);
+    }
+    mqtt_pump();
+}
+
+static void on_connect_failure(void* context, MQTTAsync_failureData* response)
+{
+    std::lock_guard<std::mutex> lock(mqtt_mutex);
+    connecting = false;
+    retry_at = std::chrono::steady_clock::now() + retry_delay;
+    retry_delay = std::min(retry_delay * 2, max_retry_delay);
+}
+
+static void on_connection_lost(void* context, char* cause)
+{
+    std::lock_guard<std::mutex> lock(mqtt_mutex);
+    connected = false;
+    // The client reconnects by itself once a connection was made
+    connecting = true;
+}
+
+// mqtt_try_connect starts a connection attempt unless the client is connected or the backoff delay hasn't passed
+static void mqtt_try_connect()
+{
+    {
+        std::lock_guard<std::mutex> lock(mqtt_mutex);
+        if (closing || connected || connecting || std::chrono::steady_clock::now() < retry_at)
+        {
+            return;
+        }
+        connecting = true;
+    }
+    if (MQTTAsync_connect(client, &conn_opts) != MQTTASYNC_SUCCESS)
+    {
+        on_connect_failure(NULL, NULL);
+    }
+}
+
 void mqtt_init(mqtt_service_config const &config)
 {
     if (mqtt_initialized)
     {
         return;
     }
+    mqtt_config = config;
+    {
+        std::lock_guard<std::mutex> lock(mqtt_mutex);
+        closing = false;
+    }
 
-    std::vector<char> server_c(
-        config.server.c_str(),
-        config.server.c_str() + config.server.size() + 1
-    );
-
-    std::vector<char> client_id_c(
-        config.client_id.c_str(),
-        config.client_id.c_str() + config.client_id.size() + 1
-    );
-
-    MQTTClient_create(&client,
-                      &server_c[0],
-                      &client_id_c[0],
-                      MQTTCLIENT_PERSISTENCE_NONE,
-                      NULL);
+    MQTTAsync_create(&client,
+                     mqtt_config.server.c_str(),
+                     mqtt_config.client_id.c_str(),
+                     MQTTCLIENT_PERSISTENCE_NONE,
+                     NULL);
 
     // connection options
     conn_opts.keepAliveInterval = 20;
     conn_opts.cleansession = 1;
+    conn_opts.automaticReconnect = 1;
+    conn_opts.minRetryInterval = 1;
+    conn_opts.maxRetryInterval = (int)max_retry_delay.count();
+    conn_opts.onFailure = on_connect_failure;
 
-    if (!config.username.empty())
+    if (!mqtt_config.username.empty())
     {
-        std::vector<char> username_c(
-            config.username.c_str(),
-            config.username.c_str() + config.username.size() + 1
-        );
-        
-        conn_opts.username = &username_c[0];
+        conn_opts.username = mqtt_config.username.c_str();
     }
 
-    if (!config.password.empty())
+    if (!mqtt_config.password.empty())
     {
-        std::vector<char> password_c(
-            config.password.c_str(),
-            config.password.c_str() + config.password.size() + 1
-        );
-        
-        conn_opts.password = &password_c[0];
+        conn_opts.password = mqtt_config.password.c_str();
     }
 
     // ssl options
-    if (!config.cert.empty() && !config.cert_key.empty() && !config.ca_root.empty())
-    {
-        std::vector<char> cert_c(
-            config.cert.c_str(),
-            config.cert.c_str() + config.cert.size() + 1
-        );
-
-        std::vector<char> cert_key_c(
-            config.cert_key.c_str(),
-            config.cert_key.c_str() + config.cert_key.size() + 1
-        );
-
-        std::vector<char> ca_root_c(
-            config.ca_root.c_str(),
-            config.ca_root.c_str() + config.ca_root.size() + 1
-        );
-        
-        sslOptions.keyStore = &cert_c[0];
-        sslOptions.privateKey = &cert_key_c[0];
-        sslOptions.trustStore = &ca_root_c[0];
+    if (!mqtt_config.cert.empty() && !mqtt_config.cert_key.empty() && !mqtt_config.ca_root.empty())
+    {
+        sslOptions.keyStore = mqtt_config.cert.c_str();
+        sslOptions.privateKey = mqtt_config.cert_key.c_str();
+        sslOptions.trustStore = mqtt_config.ca_root.c_str();
     }
     else
     {
@@ -114,7 +348,7 @@ void mqtt_init(mqtt_service_config const &config)
     mqtt_initialized = true;
 };
 
-int mqtt_start(MQTTClient_messageArrived* msgrcv)
+int mqtt_start(MQTTAsync_messageArrived* msgrcv)
 {
     auto mqtt_config_result = get_mqtt_config();
     
@@ -129,74 +363,241 @@ int mqtt_start(MQTTClient_messageArrived* msgrcv)
     }
 
     mqtt_init(mqtt_config);
-    MQTTClient_setCallbacks(client, NULL, NULL, msgrcv, NULL);
+    MQTTAsync_setCallbacks(client, NULL, on_connection_lost, msgrcv, NULL);
+    MQTTAsync_setConnected(client, NULL, on_connected);
     return 0;
 }
 
+/* mqtt_journal keeps the messages which can't be sent in the journal file at path, of up to capacity bytes.
+   Messages left in the journal by an earlier run are sent once connected */
+bool mqtt_journal(std::string const &path, size_t capacity)
+{
+    std::lock_guard<std::mutex> lock(mqtt_mutex);
+    if (!journal.open(path, capacity))
+    {
+        return false;
+    }
+    stats.journaled = journal.size();
+    return true;
+}
+
+/* mqtt_stop_sending keeps the client from connecting and sending again, and waits for a send in progress to return.
+   Acknowledgements still arriving then only update the queue, so the client can be disconnected and destroyed */
+static void mqtt_stop_sending()
+{
+    if (connector.joinable())
+    {
+        keep_connecting = false;
+        connector.join();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mqtt_mutex);
+        closing = true;
+        connected = false;
+    }
+    // A pump which saw the client connected owns pumping until it returns
+    while (pumping.load())
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
 void mqtt_close()
 {
     if (mqtt_initialized)
     {
+        mqtt_stop_sending();
+        // Give the messages in flight up to TIMEOUT to be acknowledged
+        std::chrono::steady_clock::time_point deadline =
+            std::chrono::steady_clock::now() + std::chrono::milliseconds(TIMEOUT);
+        while (MQTTAsync_isConnected(client) && std::chrono::steady_clock::now() < deadline)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mqtt_mutex);
+                if (sending.empty())
+                {
+                    break;
+                }
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
         //std::cout << "Closing MQTT..." << std::endl;
-        MQTTClient_destroy(&client);
+        MQTTAsync_destroy(&client);
+        mqtt_initialized = false;
+    }
+    // No callback comes after the client is destroyed, the messages still in flight go back in front of the queue
+    std::lock_guard<std::mutex> lock(mqtt_mutex);
+    while (!sending.empty())
+    {
+        mqtt_outbound_message* msg = sending.back();
+        sending.pop_back();
+        stats.inflight--;
+        outbound.push_front(std::move(*msg));
+        stats.queued++;
+        delete msg;
+    }
+    // Keep the messages which were not sent for the next run
+    if (journal.isOpen())
+    {
+        // Messages taken from the journal are still in it
+        for (auto const &msg: outbound)
+        {
+            if (msg.journal_end == 0)
+            {
+                journal.append(msg.topic, msg.payload.data(), msg.payload.size(), msg.coalesce);
+            }
+        }
+        outbound.clear();
+        stats.queued = 0;
+        journal.close();
+    }
+    else if (!outbound.empty())
+    {
+        std::cerr << "MQTT: " << outbound.size() << " messages were not sent" << std::endl;
     }
 };
 
+// mqtt_connect starts connecting to the MQTT server in the background, and keeps reconnecting until mqtt_disconnect
 void mqtt_connect()
 {
-    if (mqtt_initialized)
+    if (mqtt_initialized && !keep_connecting.load())
+    {
+        keep_connecting = true;
+        connector = std::thread([]() {
+            while (keep_connecting.load())
+            {
+                mqtt_try_connect();
+                mqtt_pump();
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+        });
+    }
+}
+
+// mqtt_disconnect waits up to TIMEOUT for the queued messages to be sent and disconnects from the MQTT server
+void mqtt_disconnect()
+{
+    if (!mqtt_initialized)
+    {
+        return;
+    }
+    if (connector.joinable())
+    {
+        keep_connecting = false;
+        connector.join();
+    }
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(TIMEOUT);
+    while (std::chrono::steady_clock::now() < deadline)
     {
-        int rc;
-        if ((rc = MQTTClient_connect(client, &conn_opts)) != MQTTCLIENT_SUCCESS)
         {
-            //std::cout << "Failed to connect to MQTT server, return code:" << rc << std::endl;
-            return;
+            std::lock_guard<std::mutex> lock(mqtt_mutex);
+            if (!connected || (outbound.empty() && stats.inflight == 0 && journal.empty()))
+            {
+                break;
+            }
         }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
     }
+    mqtt_stop_sending();
+    MQTTAsync_disconnectOptions opts = MQTTAsync_disconnectOptions_initializer;
+    opts.timeout = TIMEOUT;
+    MQTTAsync_disconnect(client, &opts);
 }
 
-void mqtt_disconnect()
+int mqtt_publish(std::string const &topic, std::string const &message, bool coalesce)
 {
-    if (mqtt_initialized)
+    return mqtt_publish_payload(topic, message.data(), message.size(), coalesce);
+}
+
+/* mqtt_enqueue adds a message to the outbound queue, replacing the waiting message of the topic with coalesce set,
+   or dropping the oldest message when the queue is full. mqtt_mutex must be held */
+static void mqtt_enqueue(std::string const &topic, const char *payload, size_t size, bool coalesce)
+{
+    if (coalesce)
+    {
+        for (auto &queued: outbound)
+        {
+            if (queued.coalesce && queued.topic == topic)
+            {
+                // A replaced journaled message is done with, its replacement is not in the journal
+                mqtt_acknowledge(queued);
+                queued.journal_end = 0;
+                queued.payload.assign(payload, size);
+                stats.coalesced++;
+                return;
+            }
+        }
+    }
+    if (outbound.size() >= MQTT_QUEUE_SIZE)
     {
-        MQTTClient_disconnect(client, 10000);
+        mqtt_acknowledge(outbound.front());
+        outbound.pop_front();
+        stats.queued--;
+        stats.dropped++;
     }
+    mqtt_outbound_message msg = {topic, std::string(payload, size), coalesce, 0};
+    outbound.push_back(std::move(msg));
+    stats.queued++;
 }
 
-int mqtt_publish(std::string const &topic, std::string const &message)
+/* mqtt_publish_payload queues a message for the topic and returns right away. With coalesce set, the message
+   replaces the message for the same topic which is still waiting in the queue. While the client is disconnected
+   or the journal is not drained yet, the message is appended to the journal instead. The payload may hold binary
+   data */
+int mqtt_publish_payload(std::string const &topic, const char *payload, size_t size, bool coalesce)
 {
     if (!mqtt_initialized) {
         return -1;
     }
 
-    std::vector<char> topic_c(
-        topic.c_str(),
-        topic.c_str() + topic.size() + 1
-    );
-
-    std::vector<char> message_c(
-        message.c_str(),
-        message.c_str() + message.size() + 1
-    );
-
-    pubmsg.payload = &message_c[0];
-    pubmsg.payloadlen = strlen(&message_c[0]);
-    pubmsg.qos = QOS;
-    pubmsg.retained = 0;
-    int result = MQTTClient_publishMessage(client, &topic_c[0], &pubmsg, &token);
-    if (result != 0) { // MQTTCLIENT_SUCCESS = 0
-        return result;
+    {
+        std::lock_guard<std::mutex> lock(mqtt_mutex);
+        // Once messages are journaled, the later ones follow them into the journal
+        if (journal.isOpen() && (!connected || !journal.empty()))
+        {
+            if (journal.append(topic, payload, size, coalesce))
+            {
+                stats.journaled = journal.size();
+            }
+            else
+            {
+                stats.dropped++;
+            }
+        }
+        else
+        {
+            mqtt_enqueue(topic, payload, size, coalesce);
+        }
     }
-    return MQTTClient_waitForCompletion(client, token, TIMEOUT);
+    mqtt_pump();
+    return 0;
 }
 
+// mqtt_subscribe subscribes to the topic now if connected, and again after every reconnect
 void mqtt_subscribe(std::string const &topic)
 {
     if (!mqtt_initialized) {
         return;
     }
 
-    MQTTClient_subscribe(client, topic.c_str(), 1);
+    bool subscribe_now;
+    {
+        std::lock_guard<std::mutex> lock(mqtt_mutex);
+        subscriptions.push_back(topic);
+        subscribe_now = connected;
+    }
+    if (subscribe_now)
+    {
+        MQTTAsync_subscribe(client, topic.c_str(), QOS, NULL);
+    }
+}
+
+// mqtt_stats returns the statistics of the messages handed to mqtt_publish
+mqtt_publisher_stats mqtt_stats()
+{
+    std::lock_guard<std::mutex> lock(mqtt_mutex);
+    return stats;
 }
 
 std::pair<mqtt_service_config, bool> get_mqtt_config()
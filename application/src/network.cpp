@@ -0,0 +1,65 @@
+/*
+* Copyright (c) 2018 Intel Corporation.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include <chrono>
+#include <vector>
+
+#include "network.h"
+
+using namespace std;
+using namespace cv;
+using namespace cv::dnn;
+
+// makeDirectory creates the directory path unless it exists already
+static bool makeDirectory(const string& path) {
+    return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+}
+
+string useNetworkCache(const string& dir, int backend, int target) {
+    string path = dir + "/backend" + to_string(backend) + "_target" + to_string(target);
+    if (!makeDirectory(dir) || !makeDirectory(path)) {
+        return "";
+    }
+    setenv("OPENCV_DNN_IE_GPU_CACHE_DIR", path.c_str(), 0);
+    setenv("OPENCV_OPENCL_CACHE_DIR", path.c_str(), 0);
+    setenv("OPENCV_OCL4DNN_CONFIG_PATH", path.c_str(), 0);
+    return path;
+}
+
+double warmUpNetwork(Net& net, int batch, Size size, int runs) {
+    Mat blob(vector<int>{batch, 3, size.height, size.width}, CV_32F, Scalar(0));
+    double first = 0;
+    for (int i = 0; i < runs; i++) {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        net.setInput(blob);
+        net.forward();
+        if (i == 0) {
+            first = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        }
+    }
+    return first;
+}
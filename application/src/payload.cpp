@@ -0,0 +1,181 @@
+/*
+* Copyright (c) 2018 Intel Corporation.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <stdio.h>
+
+#include <nlohmann/json.hpp>
+
+#include "payload.h"
+
+using namespace std;
+using json = nlohmann::json;
+
+// Version of the binary layout
+static const uint8_t binary_version = 1;
+
+// Message types of the binary layout
+static const uint8_t binary_counts = 0;
+static const uint8_t binary_events = 1;
+
+// Initial capacity of the encoder buffer, enough for the counts and a few dozen events
+static const size_t initial_capacity = 2048;
+
+bool parsePayloadFormat(const string& name, PayloadFormat& format) {
+    if (name == "json") {
+        format = PAYLOAD_JSON;
+    } else if (name == "cbor") {
+        format = PAYLOAD_CBOR;
+    } else if (name == "msgpack") {
+        format = PAYLOAD_MSGPACK;
+    } else if (name == "binary") {
+        format = PAYLOAD_BINARY;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* payloadFormatName(PayloadFormat format) {
+    switch (format) {
+    case PAYLOAD_CBOR:
+        return "cbor";
+    case PAYLOAD_MSGPACK:
+        return "msgpack";
+    case PAYLOAD_BINARY:
+        return "binary";
+    default:
+        return "json";
+    }
+}
+
+PayloadEncoder::PayloadEncoder(PayloadFormat format) : format_(format) {
+    buffer_.reserve(initial_capacity);
+}
+
+void PayloadEncoder::appendText(const char* text) {
+    while (*text) {
+        buffer_.push_back((uint8_t)*text++);
+    }
+}
+
+void PayloadEncoder::appendNumber(long long value) {
+    char text[24];
+    snprintf(text, sizeof(text), "%lld", value);
+    appendText(text);
+}
+
+// appendBinary appends the lowest bytes of value in little endian order
+void PayloadEncoder::appendBinary(uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        buffer_.push_back((uint8_t)(value >> (8 * i)));
+    }
+}
+
+// countsObject returns the counts of info as a JSON object, for the encodings nlohmann::json writes
+static json countsObject(const ParkingInfo& info) {
+    json msg;
+    msg["TOTAL_IN"] = info.total_in;
+    msg["TOTAL_OUT"] = info.total_out;
+    return msg;
+}
+
+/* The JSON text is written directly into the buffer rather than through nlohmann::json, which would build the
+   objects and the text as new strings for every message. The keys are in the order nlohmann::json sorts them */
+void PayloadEncoder::counts(const ParkingInfo& info) {
+    buffer_.clear();
+    switch (format_) {
+    case PAYLOAD_JSON:
+        appendText("{\"TOTAL_IN\":");
+        appendNumber(info.total_in);
+        appendText(",\"TOTAL_OUT\":");
+        appendNumber(info.total_out);
+        appendText("}");
+        break;
+    case PAYLOAD_CBOR:
+        json::to_cbor(countsObject(info), buffer_);
+        break;
+    case PAYLOAD_MSGPACK:
+        json::to_msgpack(countsObject(info), buffer_);
+        break;
+    case PAYLOAD_BINARY:
+        appendText("PC");
+        appendBinary(binary_version, 1);
+        appendBinary(binary_counts, 1);
+        appendBinary((uint32_t)info.total_in, 4);
+        appendBinary((uint32_t)info.total_out, 4);
+        break;
+    }
+}
+
+void PayloadEncoder::events(const ParkingInfo& info, const vector<StampedEvent>& events) {
+    buffer_.clear();
+    if (format_ == PAYLOAD_JSON) {
+        appendText("{\"EVENTS\":[");
+        for (size_t i = 0; i < events.size(); i++) {
+            appendText(i == 0 ? "{\"DIRECTION\":\"" : ",{\"DIRECTION\":\"");
+            appendText(events[i].event.direction > 0 ? "in" : "out");
+            appendText("\",\"ID\":");
+            appendNumber(events[i].event.id);
+            appendText(",\"TIME\":");
+            appendNumber(events[i].time);
+            appendText("}");
+        }
+        appendText("],\"TOTAL_IN\":");
+        appendNumber(info.total_in);
+        appendText(",\"TOTAL_OUT\":");
+        appendNumber(info.total_out);
+        appendText("}");
+        return;
+    }
+
+    if (format_ == PAYLOAD_BINARY) {
+        appendText("PC");
+        appendBinary(binary_version, 1);
+        appendBinary(binary_events, 1);
+        appendBinary((uint32_t)info.total_in, 4);
+        appendBinary((uint32_t)info.total_out, 4);
+        appendBinary(events.size(), 4);
+        for (size_t i = 0; i < events.size(); i++) {
+            appendBinary((uint32_t)events[i].event.id, 4);
+            appendBinary((uint8_t)(int8_t)events[i].event.direction, 1);
+            appendBinary((uint64_t)events[i].time, 8);
+        }
+        return;
+    }
+
+    json msg = countsObject(info);
+    json list = json::array();
+    for (auto const& e: events) {
+        json event;
+        event["ID"] = e.event.id;
+        event["DIRECTION"] = e.event.direction > 0 ? "in" : "out";
+        event["TIME"] = e.time;
+        list.push_back(event);
+    }
+    msg["EVENTS"] = list;
+    if (format_ == PAYLOAD_CBOR) {
+        json::to_cbor(msg, buffer_);
+    } else {
+        json::to_msgpack(msg, buffer_);
+    }
+}
@@ -0,0 +1,269 @@
+/*
+* Copyright (c) 2018 Intel Corporation.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <string.h>
+#include <float.h>
+#include <math.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define BLOB_RESIZER_X86 1
+#endif
+
+#include <opencv2/dnn.hpp>
+
+#include "preprocess.h"
+
+using namespace std;
+using namespace cv;
+using namespace cv::dnn;
+
+// Fixed point precision of the interpolation weights, the same as the one of cv::resize for 8-bit images
+static const int coef_bits = 11;
+static const int coef_scale = 1 << coef_bits;
+
+/* BlendRow blends width values of two horizontally interpolated rows with the weights of the upper and the lower
+   row into out. All the variants round the same way as the vectorized vertical pass of cv::resize: the 22 bits of
+   fraction are dropped in two steps, from the product of each row and from the sum */
+typedef void (*BlendRow)(const int* upper, const int* lower, short b0, short b1, float* out, int width);
+
+static void blendScalar(const int* upper, const int* lower, short b0, short b1, float* out, int width) {
+    for (int x = 0; x < width; x++) {
+        int v = (((upper[x] >> 4) * b0) >> 16) + (((lower[x] >> 4) * b1) >> 16);
+        out[x] = (float)((v + 2) >> 2);
+    }
+}
+
+#ifdef BLOB_RESIZER_X86
+#ifdef __SSE2__
+// blendSse2 blends 8 values at a time in 16-bit lanes, a row value shifted by 4 bits always fits 16 bits
+static void blendSse2(const int* upper, const int* lower, short b0, short b1, float* out, int width) {
+    const __m128i w0 = _mm_set1_epi16(b0);
+    const __m128i w1 = _mm_set1_epi16(b1);
+    const __m128i two = _mm_set1_epi16(2);
+    const __m128i zero = _mm_setzero_si128();
+    int x = 0;
+    for (; x <= width - 8; x += 8) {
+        __m128i u = _mm_packs_epi32(_mm_srai_epi32(_mm_loadu_si128((const __m128i*)(upper + x)), 4),
+                                    _mm_srai_epi32(_mm_loadu_si128((const __m128i*)(upper + x + 4)), 4));
+        __m128i l = _mm_packs_epi32(_mm_srai_epi32(_mm_loadu_si128((const __m128i*)(lower + x)), 4),
+                                    _mm_srai_epi32(_mm_loadu_si128((const __m128i*)(lower + x + 4)), 4));
+        __m128i v = _mm_add_epi16(_mm_mulhi_epi16(u, w0), _mm_mulhi_epi16(l, w1));
+        v = _mm_srai_epi16(_mm_add_epi16(v, two), 2);
+        _mm_storeu_ps(out + x, _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero)));
+        _mm_storeu_ps(out + x + 4, _mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero)));
+    }
+    blendScalar(upper + x, lower + x, b0, b1, out + x, width - x);
+}
+#endif
+
+/* blendAvx2 blends 16 values at a time in 32-bit lanes, which avoids the lane crossing of the 16-bit packs.
+   It is compiled for AVX2 whatever the flags of the build and only used when the processor has it */
+__attribute__((target("avx2")))
+static void blendAvx2(const int* upper, const int* lower, short b0, short b1, float* out, int width) {
+    const __m256i w0 = _mm256_set1_epi32(b0);
+    const __m256i w1 = _mm256_set1_epi32(b1);
+    const __m256i two = _mm256_set1_epi32(2);
+    int x = 0;
+    for (; x <= width - 16; x += 16) {
+        for (int k = 0; k < 16; k += 8) {
+            __m256i u = _mm256_srai_epi32(_mm256_loadu_si256((const __m256i*)(upper + x + k)), 4);
+            __m256i l = _mm256_srai_epi32(_mm256_loadu_si256((const __m256i*)(lower + x + k)), 4);
+            __m256i v = _mm256_add_epi32(_mm256_srai_epi32(_mm256_mullo_epi32(u, w0), 16),
+                                         _mm256_srai_epi32(_mm256_mullo_epi32(l, w1), 16));
+            v = _mm256_srai_epi32(_mm256_add_epi32(v, two), 2);
+            _mm256_storeu_ps(out + x + k, _mm256_cvtepi32_ps(v));
+        }
+    }
+    blendScalar(upper + x, lower + x, b0, b1, out + x, width - x);
+}
+#endif
+
+bool BlobResizer::supported(BlendKernel kernel) {
+    switch (kernel) {
+#ifdef BLOB_RESIZER_X86
+    case BLEND_AVX2:
+        return checkHardwareSupport(CV_CPU_AVX2);
+#ifdef __SSE2__
+    case BLEND_SSE2:
+        return checkHardwareSupport(CV_CPU_SSE2);
+#endif
+#endif
+    case BLEND_AUTO:
+    case BLEND_SCALAR:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* blendFunction returns the variant of kernel, or the fastest variant the processor supports for BLEND_AUTO and
+   for a variant it doesn't support. It follows cv::setUseOptimized, which makes checkHardwareSupport report no
+   extension at all */
+static BlendRow blendFunction(BlendKernel kernel) {
+    if (kernel == BLEND_SCALAR) {
+        return blendScalar;
+    }
+#ifdef BLOB_RESIZER_X86
+    if ((kernel == BLEND_AUTO || kernel == BLEND_AVX2) && BlobResizer::supported(BLEND_AVX2)) {
+        return blendAvx2;
+    }
+#ifdef __SSE2__
+    if (BlobResizer::supported(BLEND_SSE2)) {
+        return blendSse2;
+    }
+#endif
+#endif
+    return blendScalar;
+}
+
+// weight converts an interpolation weight to fixed point like cv::resize, rounding half to even
+static short weight(float w) {
+    return saturate_cast<short>(w * coef_scale);
+}
+
+// halves returns true when cv::resize switches from bilinear to area interpolation, for a shrink by exactly half
+static bool halves(Size from, Size to) {
+    double scale_x = 1. / ((double)to.width / from.width);
+    double scale_y = 1. / ((double)to.height / from.height);
+    int iscale_x = saturate_cast<int>(scale_x);
+    int iscale_y = saturate_cast<int>(scale_y);
+    return iscale_x == 2 && iscale_y == 2 && fabs(scale_x - iscale_x) < DBL_EPSILON &&
+           fabs(scale_y - iscale_y) < DBL_EPSILON;
+}
+
+BlobResizer::BlobResizer(BlendKernel kernel) : kernel(kernel) {}
+
+void BlobResizer::prepare(Size from, Size to) {
+    this->from = from;
+    this->to = to;
+    // The scales and the source coordinates are computed with the same types and in the same order as cv::resize
+    double scale_x = 1. / ((double)to.width / from.width);
+    double scale_y = 1. / ((double)to.height / from.height);
+
+    xofs.resize(2 * to.width);
+    alpha.resize(2 * to.width);
+    for (int dx = 0; dx < to.width; dx++) {
+        float fx = (float)((dx + 0.5) * scale_x - 0.5);
+        int sx = cvFloor(fx);
+        fx -= sx;
+        if (sx < 0) {
+            fx = 0;
+            sx = 0;
+        }
+        if (sx >= from.width - 1) {
+            fx = 0;
+            sx = from.width - 1;
+        }
+        xofs[2 * dx] = sx * 3;
+        xofs[2 * dx + 1] = min(sx + 1, from.width - 1) * 3;
+        alpha[2 * dx] = weight(1.f - fx);
+        alpha[2 * dx + 1] = weight(fx);
+    }
+
+    yofs.resize(to.height);
+    beta.resize(2 * to.height);
+    for (int dy = 0; dy < to.height; dy++) {
+        float fy = (float)((dy + 0.5) * scale_y - 0.5);
+        int sy = cvFloor(fy);
+        fy -= sy;
+        yofs[dy] = sy;
+        beta[2 * dy] = weight(1.f - fy);
+        beta[2 * dy + 1] = weight(fy);
+    }
+    rows.resize(2 * 3 * to.width);
+}
+
+// interpolateRow interpolates the source row src horizontally into the 3 channel planes of dst
+void BlobResizer::interpolateRow(const unsigned char* src, int* dst) const {
+    int* b = dst;
+    int* g = dst + to.width;
+    int* r = dst + 2 * to.width;
+    for (int dx = 0; dx < to.width; dx++) {
+        const unsigned char* left = src + xofs[2 * dx];
+        const unsigned char* right = src + xofs[2 * dx + 1];
+        int a0 = alpha[2 * dx];
+        int a1 = alpha[2 * dx + 1];
+        b[dx] = left[0] * a0 + right[0] * a1;
+        g[dx] = left[1] * a0 + right[1] * a1;
+        r[dx] = left[2] * a0 + right[2] * a1;
+    }
+}
+
+void BlobResizer::resize(const Mat& image, Size size, float* out) {
+    size_t plane = (size_t)size.area();
+    if (image.type() != CV_8UC3 || halves(image.size(), size)) {
+        blobFromImage(image, fallback, 1.0, size);
+        memcpy(out, fallback.ptr<float>(), 3 * plane * sizeof(float));
+        return;
+    }
+    if (image.size() != from || size != to) {
+        prepare(image.size(), size);
+    }
+
+    BlendRow blend = blendFunction(kernel);
+    int* upper = &rows[0];
+    int* lower = upper + 3 * to.width;
+    int upper_row = -1;
+    int lower_row = -1;
+    for (int dy = 0; dy < to.height; dy++) {
+        int sy0 = min(max(yofs[dy], 0), from.height - 1);
+        int sy1 = min(max(yofs[dy] + 1, 0), from.height - 1);
+        // Consecutive output rows mostly share source rows, each source row is interpolated only once
+        if (sy0 != upper_row) {
+            if (sy0 == lower_row) {
+                swap(upper, lower);
+                lower_row = upper_row;
+            } else {
+                interpolateRow(image.ptr<unsigned char>(sy0), upper);
+            }
+            upper_row = sy0;
+        }
+        if (sy1 != sy0 && sy1 != lower_row) {
+            interpolateRow(image.ptr<unsigned char>(sy1), lower);
+            lower_row = sy1;
+        }
+        const int* below = sy1 == sy0 ? upper : lower;
+
+        float* row = out + (size_t)dy * to.width;
+        for (int c = 0; c < 3; c++) {
+            blend(upper + c * to.width, below + c * to.width, beta[2 * dy], beta[2 * dy + 1],
+                  row + c * plane, to.width);
+        }
+    }
+}
+
+void BlobResizer::batch(const vector<Mat>& images, Mat& blob, Size size) {
+    int shape[] = {(int)images.size(), 3, size.height, size.width};
+    blob.create(4, shape, CV_32F);
+    size_t item = 3 * (size_t)size.area();
+    float* out = blob.ptr<float>();
+    for (size_t n = 0; n < images.size(); n++) {
+        // The padding of a batch repeats the last image, which is copied instead of being resized again
+        if (n > 0 && images[n].data == images[n - 1].data && images[n].size() == images[n - 1].size()) {
+            memcpy(out + n * item, out + (n - 1) * item, item * sizeof(float));
+        } else {
+            resize(images[n], size, out + n * item);
+        }
+    }
+}
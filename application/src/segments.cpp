@@ -0,0 +1,119 @@
+/*
+* Copyright (c) 2018 Intel Corporation.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <algorithm>
+#include <unordered_set>
+
+#include "association.h"
+#include "segments.h"
+
+using namespace std;
+using namespace cv;
+
+vector<Segment> planSegments(long frames, int count, long overlap) {
+    vector<Segment> segments;
+    count = (int)max(1L, min((long)count, frames));
+    for (int k = 0; k < count; k++) {
+        Segment s;
+        s.start = frames * k / count;
+        s.end = frames * (k + 1) / count;
+        s.first = max(0L, s.start - overlap);
+        s.last = min(frames, s.end + overlap);
+        segments.push_back(s);
+    }
+    return segments;
+}
+
+vector<SegmentCar> segmentCars(const CounterContext& ctx) {
+    vector<SegmentCar> cars;
+    const TrackSet& tracks = ctx.tracks;
+    for (size_t i = 0; i < tracks.size(); i++) {
+        if (!tracks.gone[i]) {
+            SegmentCar car = {tracks.id[i], tracks.p[i]};
+            cars.push_back(car);
+        }
+    }
+    return cars;
+}
+
+/* matchBoundary matches the cars in view of the earlier segment at a boundary with the ones in view of the later
+   segment, and adds the ids of the matched cars of each segment to before and after */
+static void matchBoundary(const vector<SegmentCar>& exit, const vector<SegmentCar>& entry, int max_distance,
+                          unordered_set<int>& before, unordered_set<int>& after) {
+    vector<Point> tracked, points;
+    for (auto const& car: exit) {
+        tracked.push_back(car.p);
+    }
+    for (auto const& car: entry) {
+        points.push_back(car.p);
+    }
+    if (tracked.empty() || points.empty()) {
+        return;
+    }
+    AssociationGate gate = {max_distance, max_distance, max_distance};
+    vector<int> assigned = assignPoints(points, tracked, gate);
+    for (size_t i = 0; i < assigned.size(); i++) {
+        if (assigned[i] >= 0) {
+            before.insert(exit[assigned[i]].id);
+            after.insert(entry[i].id);
+        }
+    }
+}
+
+void stitchSegments(const vector<SegmentResult>& results, int max_distance, int& total_in, int& total_out) {
+    total_in = 0;
+    total_out = 0;
+    /* handed holds the ids of the cars of the current segment which the previous segment counts, up to
+       handed_until, the last frame the previous segment tracked */
+    unordered_set<int> handed;
+    long handed_until = 0;
+    for (size_t k = 0; k < results.size(); k++) {
+        const SegmentResult& r = results[k];
+        // kept holds the ids of the cars at the end of the segment which it keeps counting after its end
+        unordered_set<int> kept, next_handed;
+        if (k + 1 < results.size()) {
+            matchBoundary(r.exit, results[k + 1].entry, max_distance, kept, next_handed);
+        }
+
+        for (auto const& e: r.events) {
+            bool counted;
+            if (e.frame < r.segment.start) {
+                // The previous segment counts the cars before the boundary
+                counted = false;
+            } else if (e.frame < r.segment.end || k + 1 == results.size()) {
+                counted = e.frame >= handed_until || !handed.count(e.event.id);
+            } else {
+                counted = kept.count(e.event.id) > 0;
+            }
+            if (counted) {
+                if (e.event.direction > 0) {
+                    total_in++;
+                } else {
+                    total_out++;
+                }
+            }
+        }
+        handed.swap(next_handed);
+        handed_until = r.segment.last;
+    }
+}
@@ -0,0 +1,239 @@
+/*
+* Copyright (c) 2018 Intel Corporation.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdlib.h>
+#include <stdio.h>
+
+// OpenCV includes
+#include <opencv2/core.hpp>
+
+#include "tracker.h"
+#include "detections.h"
+#include "detection_log.h"
+
+using namespace std;
+using namespace cv;
+
+/* The sweep tool runs the car tracker over a detection log recorded with -record once for every combination of
+   a grid of tracker parameters, and ranks the parameter sets by the error of their counts against the known in
+   and out counts of the recording. Every parameter set gets its own tracker, and the sets are spread over all
+   the cores. Every parameter takes a comma separated list of values, or a start:stop:step range */
+
+const char* keys =
+    "{ help     | | Print help message. }"
+    "{ @log        | | Detection log file recorded with -record. }"
+    "{ in          | -1 | Number of cars which actually went in during the recording. }"
+    "{ out         | -1 | Number of cars which actually went out during the recording. }"
+    "{ entrance e  | b | Plane axis for parking entrance and exit division mark: b, t, l or r. }"
+    "{ stride ds   | 1 | Detection stride the log was recorded with. }"
+    "{ carconf cc  | 0.5 | Confidence factors for car detection to try. }"
+    "{ max_distance md  | 200 | Max distances in pixels between two related centroids to try. }"
+    "{ max_frames_gone mg | 25 | Max numbers of frames to track a missing centroid to try. }"
+    "{ min_car_size mcs | 70 | Min widths and heights in pixels of a detected car to try. }"
+    "{ clip_width cw | 200 | Max widths in pixels of a detected car to try. }"
+    "{ clip_height ch | 350 | Max heights in pixels of a detected car to try. }"
+    "{ threads j   | 0 | Number of worker threads. 0 uses all the cores. }"
+    "{ top n       | 10 | Number of best parameter sets to print. }";
+
+// LogFrame points at the detections of a frame in the memory mapped log
+struct LogFrame {
+    FrameMode mode;
+    const float* rows;
+    size_t count;
+};
+
+// SweepParams is one combination of the swept parameters
+struct SweepParams {
+    DetectionFilter filter;
+    int max_distance;
+    int max_frames_gone;
+};
+
+// SweepResult holds the counts of a parameter set and the time its tracker took per frame
+struct SweepResult {
+    SweepParams params;
+    int total_in;
+    int total_out;
+    int error;
+    double frame_us;
+};
+
+/* parseValues parses a comma separated list of values, or a start:stop:step range, and returns false
+   when text is neither */
+static bool parseValues(const string& text, vector<double>& values) {
+    values.clear();
+    double start, stop, step;
+    char tail;
+    if (sscanf(text.c_str(), "%lf:%lf:%lf%c", &start, &stop, &step, &tail) == 3) {
+        if (step <= 0 || stop < start) {
+            return false;
+        }
+        // Allow for rounding errors of fractional steps at the end of the range
+        for (double v = start; v <= stop + step * 1e-6; v += step) {
+            values.push_back(v);
+        }
+        return true;
+    }
+    size_t begin = 0;
+    while (begin <= text.size()) {
+        size_t end = text.find(',', begin);
+        if (end == string::npos) {
+            end = text.size();
+        }
+        string item = text.substr(begin, end - begin);
+        char* rest = NULL;
+        double v = strtod(item.c_str(), &rest);
+        if (item.empty() || *rest != '\0') {
+            return false;
+        }
+        values.push_back(v);
+        begin = end + 1;
+    }
+    return !values.empty();
+}
+
+// runParams tracks the cars of all the frames of the log with a fresh tracker set up with the parameters
+static SweepResult runParams(const SweepParams& params, const vector<LogFrame>& frames, const string& entrance,
+                             int stride, Size size, Rect roi) {
+    CounterContext ctx;
+    initCounterContext(ctx, entrance, params.max_distance, params.max_frames_gone);
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (const LogFrame& f: frames) {
+        trackDetections(ctx, f.mode, f.rows, f.count, size, roi, params.filter, stride);
+    }
+    double elapsed = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+
+    SweepResult result;
+    result.params = params;
+    result.total_in = ctx.total_in;
+    result.total_out = ctx.total_out;
+    result.error = 0;
+    result.frame_us = frames.empty() ? 0 : elapsed / frames.size();
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    CommandLineParser parser(argc, argv, keys);
+    parser.about("Use this tool to tune the car tracker on a detection log.");
+    if (argc == 1 || parser.has("help"))
+    {
+        parser.printMessage();
+        return 0;
+    }
+
+    string path = parser.get<string>("@log");
+    int truth_in = parser.get<int>("in");
+    int truth_out = parser.get<int>("out");
+    if (path.empty() || truth_in < 0 || truth_out < 0) {
+        cerr << "ERROR! A detection log and the actual in and out counts are required\n";
+        return -1;
+    }
+    string entrance = parser.get<string>("entrance");
+    int stride = max(1, parser.get<int>("stride"));
+    unsigned threads = max(0, parser.get<int>("threads"));
+    if (threads == 0) {
+        threads = max(1u, thread::hardware_concurrency());
+    }
+    size_t top = max(1, parser.get<int>("top"));
+
+    const char* names[] = {"carconf", "max_distance", "max_frames_gone", "min_car_size", "clip_width", "clip_height"};
+    vector<double> grid[6];
+    for (int i = 0; i < 6; i++) {
+        if (!parseValues(parser.get<string>(names[i]), grid[i])) {
+            cerr << "ERROR! Invalid values of " << names[i] << ": " << parser.get<string>(names[i]) << "\n";
+            return -1;
+        }
+    }
+
+    DetectionReader log;
+    if (!log.open(path) || log.header().row_size != 7) {
+        cerr << "ERROR! Unable to read detection log " << path << "\n";
+        return -1;
+    }
+    // The frames are indexed once, every tracker then reads the rows straight from the mapped log
+    vector<LogFrame> frames;
+    DetectionRecord record;
+    const float* rows = NULL;
+    while (log.next(record, rows)) {
+        LogFrame f = {(FrameMode)record.mode, rows, record.rows};
+        frames.push_back(f);
+    }
+
+    vector<SweepParams> sets;
+    for (double cc: grid[0]) for (double md: grid[1]) for (double mg: grid[2])
+    for (double ms: grid[3]) for (double cw: grid[4]) for (double ch: grid[5]) {
+        SweepParams p;
+        p.filter.confidence = (float)cc;
+        p.filter.min_size = (int)ms;
+        p.filter.clip_width = (int)cw;
+        p.filter.clip_height = (int)ch;
+        p.max_distance = (int)md;
+        p.max_frames_gone = (int)mg;
+        sets.push_back(p);
+    }
+
+    // Every worker takes the next parameter set which nobody runs yet, the results are written to their own slots
+    vector<SweepResult> results(sets.size());
+    atomic<size_t> next(0);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    vector<thread> workers;
+    for (unsigned t = 0; t < min((size_t)threads, sets.size()); t++) {
+        workers.push_back(thread([&]() {
+            for (size_t i = next++; i < sets.size(); i = next++) {
+                results[i] = runParams(sets[i], frames, entrance, stride, log.size(), log.roi());
+                results[i].error = abs(results[i].total_in - truth_in) + abs(results[i].total_out - truth_out);
+            }
+        }));
+    }
+    for (auto& w: workers) {
+        w.join();
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    // Rank by count error, and the cheaper tracker first among equally good ones
+    sort(results.begin(), results.end(), [](const SweepResult& a, const SweepResult& b) {
+        return a.error != b.error ? a.error < b.error : a.frame_us < b.frame_us;
+    });
+
+    cout << format("Swept %zu parameter sets over %zu frames on %zu threads in %.2f s, actual counts in %d out %d",
+                   sets.size(), frames.size(), workers.size(), seconds, truth_in, truth_out) << endl;
+    cout << format("%4s %6s %5s %5s %8s %6s %6s %6s %6s %6s %9s",
+                   "rank", "error", "in", "out", "carconf", "md", "mg", "mcs", "cw", "ch", "us/frame") << endl;
+    for (size_t i = 0; i < min(top, results.size()); i++) {
+        const SweepResult& r = results[i];
+        cout << format("%4zu %6d %5d %5d %8.3f %6d %6d %6d %6d %6d %9.2f",
+                       i + 1, r.error, r.total_in, r.total_out, r.params.filter.confidence, r.params.max_distance,
+                       r.params.max_frames_gone, r.params.filter.min_size, r.params.filter.clip_width,
+                       r.params.filter.clip_height, r.frame_us) << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,360 @@
+/*
+* Copyright (c) 2018 Intel Corporation.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <algorithm>
+#include <math.h>
+
+#include "tracker.h"
+#include "association.h"
+
+using namespace std;
+using namespace cv;
+
+const int TrackSet::history;
+
+// add appends a new car at the end of the arrays and returns its slot
+size_t TrackSet::add(int car_id, Point pos) {
+    size_t slot = id.size();
+    id.push_back(car_id);
+    p.push_back(pos);
+    gone_count.push_back(0);
+    direction.push_back(0);
+    counted.push_back(0);
+    gone.push_back(0);
+    axis_sum.push_back(0);
+    samples.push_back(0);
+    recent.resize(recent.size() + history);
+    return slot;
+}
+
+// remove drops the car in the slot and moves the last car into it, the slots of the other cars don't change
+void TrackSet::remove(size_t slot) {
+    size_t last = id.size() - 1;
+    if (slot != last) {
+        id[slot] = id[last];
+        p[slot] = p[last];
+        gone_count[slot] = gone_count[last];
+        direction[slot] = direction[last];
+        counted[slot] = counted[last];
+        gone[slot] = gone[last];
+        axis_sum[slot] = axis_sum[last];
+        samples[slot] = samples[last];
+        copy(recent.begin() + last * history, recent.end(), recent.begin() + slot * history);
+    }
+    id.pop_back();
+    p.pop_back();
+    gone_count.pop_back();
+    direction.pop_back();
+    counted.pop_back();
+    gone.pop_back();
+    axis_sum.pop_back();
+    samples.pop_back();
+    recent.resize(recent.size() - history);
+}
+
+void TrackSet::clear() {
+    id.clear();
+    p.clear();
+    gone_count.clear();
+    direction.clear();
+    counted.clear();
+    gone.clear();
+    axis_sum.clear();
+    samples.clear();
+    recent.clear();
+}
+
+/* Entrance resolves the movement axis and the counting sign of an entrance edge at compile time, so the
+   tracker passes below don't compare entrance strings for every car. Side 0 stands for an unknown entrance,
+   its axis is always 0, so the cars are tracked but never counted */
+template <char Side>
+struct Entrance {
+    // When movement is horizontal only consider trajectory along X axis, when vertical only along Y axis
+    static const int wx = (Side == 'l' || Side == 'r') ? 1 : 0;
+    static const int wy = (Side == 't' || Side == 'b') ? 1 : 0;
+    /* inbound is the sign of the direction of the cars entering the parking: "positive" when movement
+       along Y/X axis goes up for the top and left entrances, "negative" for the bottom and right ones */
+    static const int inbound = (Side == 't' || Side == 'l') ? 1 : ((Side == 'b' || Side == 'r') ? -1 : 0);
+
+    static int axis(Point p) {
+        return wx * p.x + wy * p.y;
+    }
+};
+
+// entranceSide maps the entrance parameter to the side handled by Entrance
+static char entranceSide(const string& entrance) {
+    if (entrance == "t" || entrance == "b" || entrance == "l" || entrance == "r") {
+        return entrance[0];
+    }
+    return 0;
+}
+
+// forEntrance runs Pass specialized for the entrance side of the context
+template <class Pass>
+static void forEntrance(CounterContext& ctx) {
+    switch (ctx.side) {
+    case 't': Pass::template run<Entrance<'t'> >(ctx); break;
+    case 'b': Pass::template run<Entrance<'b'> >(ctx); break;
+    case 'l': Pass::template run<Entrance<'l'> >(ctx); break;
+    case 'r': Pass::template run<Entrance<'r'> >(ctx); break;
+    default:  Pass::template run<Entrance<0> >(ctx); break;
+    }
+}
+
+// initCounterContext resets the counting state and sets the tracker parameters of the stream
+void initCounterContext(CounterContext& ctx, const string& entrance, int max_distance, int max_frames_gone) {
+    ctx.entrance = entrance;
+    ctx.max_distance = max_distance;
+    ctx.max_frames_gone = max_frames_gone;
+    ctx.side = entranceSide(entrance);
+    ctx.tracks.clear();
+    ctx.id = 0;
+    ctx.total_in = 0;
+    ctx.total_out = 0;
+    ctx.events.clear();
+}
+
+// addCentroid starts tracking a new car at the point and increments id counter
+static void addCentroid(CounterContext& ctx, Point p) {
+    ctx.tracks.add(ctx.id, p);
+    ctx.id++;
+}
+
+/* associationGate returns the gate of the centroid association. When the movement is horizontal, only
+   centroids with some small Y coordinate fluctuation are considered, and the other way round */
+static AssociationGate associationGate(const CounterContext& ctx) {
+    AssociationGate gate;
+    gate.max_distance = ctx.max_distance;
+    gate.max_dx = ctx.max_distance;
+    gate.max_dy = ctx.max_distance;
+    if (ctx.side == 'l' || ctx.side == 'r') {
+        gate.max_dy = 70;
+    }
+    if (ctx.side == 'b' || ctx.side == 't') {
+        gate.max_dx = 50;
+    }
+    return gate;
+}
+
+/* updateCentroids takes detected centroid points and updates tracked cars. Cars missing for more than
+   max_frames_gone frames are marked gone, updateCarTotals counts them and drops them */
+void updateCentroids(CounterContext& ctx, const vector<Point>& points) {
+    TrackSet& tracks = ctx.tracks;
+
+    // Only the cars which are not gone take part in the association
+    vector<size_t> slots;
+    vector<Point> tracked;
+    for (size_t i = 0; i < tracks.size(); i++) {
+        if (!tracks.gone[i]) {
+            slots.push_back(i);
+            tracked.push_back(tracks.p[i]);
+        }
+    }
+
+    /* Associate the detected points with the tracked centroids as a whole, rather than point by point,
+       so two points never compete for the same centroid */
+    vector<int> assigned(points.size(), -1);
+    if (!points.empty() && !tracked.empty()) {
+        assigned = assignPoints(points, tracked, associationGate(ctx));
+    }
+
+    // Iterate through all associated points and update tracked centroid positions
+    vector<unsigned char> checked(slots.size(), 0);
+    for (size_t i = 0; i < points.size(); i++) {
+        if (assigned[i] < 0) {
+            continue;
+        }
+        size_t slot = slots[assigned[i]];
+        tracks.p[slot] = points[i];
+        tracks.gone_count[slot] = 0;
+        checked[assigned[i]] = 1;
+    }
+
+    /* Iterate through all *already tracked* centroids and increment their gone frame count,
+       if they weren't updated from the list of detected centroid points */
+    for (size_t k = 0; k < slots.size(); k++) {
+        size_t slot = slots[k];
+        if (!checked[k] && ++tracks.gone_count[slot] > ctx.max_frames_gone) {
+            tracks.gone[slot] = 1;
+        }
+    }
+
+    /* Iterate through *detected* centroids and add the ones which werent associated
+       with any of the tracked centroids and add start tracking them */
+    for (size_t i = 0; i < points.size(); i++) {
+        if (assigned[i] < 0) {
+            addCentroid(ctx, points[i]);
+        }
+    }
+}
+
+// trajectoryPoint returns trajectory point k of the car in the slot, k must be one of its last history points
+static inline Point trajectoryPoint(const TrackSet& tracks, size_t slot, int k) {
+    return tracks.recent[slot * TrackSet::history + k % TrackSet::history];
+}
+
+/* TrajectoryPass extends the trajectory of every car which is not gone with its current centroid. The direction
+   of the car is the difference between its current position and its mean position so far along the movement axis */
+struct TrajectoryPass {
+    template <class E>
+    static void run(CounterContext& ctx) {
+        TrackSet& tracks = ctx.tracks;
+        for (size_t i = 0; i < tracks.size(); i++) {
+            if (tracks.gone[i]) {
+                continue;
+            }
+            Point p = tracks.p[i];
+            int n = tracks.samples[i];
+            if (n == 0) {
+                tracks.direction[i] = 0;
+            } else {
+                // Calculate average centroid movement from car trajectory
+                int movement = (int)(tracks.axis_sum[i] / n);
+                tracks.direction[i] = E::axis(p) - movement;
+            }
+
+            tracks.axis_sum[i] += E::axis(p);
+            tracks.samples[i] = n + 1;
+            tracks.recent[i * TrackSet::history + n % TrackSet::history] = p;
+        }
+    }
+};
+
+// centroids2Cars adds the updated centroids to the trajectories of the tracked cars
+void centroids2Cars(CounterContext& ctx) {
+    forEntrance<TrajectoryPass>(ctx);
+}
+
+/* carVelocity estimates the movement of the car per frame as the mean displacement over the last frames
+   points of its trajectory, at most TrackSet::history - 1 of them */
+Point2f carVelocity(const TrackSet& tracks, size_t slot, int frames) {
+    int n = tracks.samples[slot] - 1;
+    int m = min(min(frames, n), TrackSet::history - 1);
+    if (m <= 0) {
+        return Point2f(0, 0);
+    }
+    Point d = trajectoryPoint(tracks, slot, n) - trajectoryPoint(tracks, slot, n - m);
+    return Point2f((float)d.x / m, (float)d.y / m);
+}
+
+/* predictCentroids returns the positions of the centroids seen in the last frame, moved one frame ahead
+   with the velocity of their car. Centroids which are already missing are not predicted, so they keep aging */
+vector<Point> predictCentroids(const CounterContext& ctx, int history) {
+    const TrackSet& tracks = ctx.tracks;
+    vector<Point> points;
+    for (size_t i = 0; i < tracks.size(); i++) {
+        if (tracks.gone[i] || tracks.gone_count[i] > 0) {
+            continue;
+        }
+        Point2f v = carVelocity(tracks, i, history);
+        points.push_back(Point(tracks.p[i].x + cvRound(v.x), tracks.p[i].y + cvRound(v.y)));
+    }
+    return points;
+}
+
+// maxCarSpeed returns the speed in pixels per frame of the fastest car seen in the last frame
+double maxCarSpeed(const CounterContext& ctx, int history) {
+    const TrackSet& tracks = ctx.tracks;
+    double speed = 0;
+    for (size_t i = 0; i < tracks.size(); i++) {
+        if (tracks.gone[i] || tracks.gone_count[i] > 0) {
+            continue;
+        }
+        Point2f v = carVelocity(tracks, i, history);
+        speed = max(speed, sqrt((double)(v.x*v.x + v.y*v.y)));
+    }
+    return speed;
+}
+
+/* TotalsPass counts the cars moving in the inbound direction as soon as they are seen, and the cars moving
+   the other way once they are gone. Gone cars can't move anymore, so they are dropped after that */
+struct TotalsPass {
+    template <class E>
+    static void run(CounterContext& ctx) {
+        TrackSet& tracks = ctx.tracks;
+        for (size_t i = 0; i < tracks.size(); ) {
+            int heading = tracks.direction[i] * E::inbound;
+            if (!tracks.counted[i]) {
+                if (!tracks.gone[i] && heading > 0) {
+                    ctx.total_in++;
+                    tracks.counted[i] = 1;
+                    CountEvent in = {tracks.id[i], 1};
+                    ctx.events.push_back(in);
+                }
+                if (tracks.gone[i] && heading < 0) {
+                    ctx.total_out++;
+                    CountEvent out = {tracks.id[i], -1};
+                    ctx.events.push_back(out);
+                }
+            }
+            if (tracks.gone[i]) {
+                // The last car moves into this slot, so look at the same slot again
+                tracks.remove(i);
+                continue;
+            }
+            i++;
+        }
+    }
+};
+
+/* updateCarTotals iterates through all tracked cars and updates total counts both in and out of the parking.
+   The cars it counts are listed in the events of the context until the next call */
+void updateCarTotals(CounterContext& ctx) {
+    ctx.events.clear();
+    forEntrance<TotalsPass>(ctx);
+}
+
+/* counterInfo fills info with a snapshot of the counting state of the stream. The centroids of info are
+   overwritten in place, so a reused ParkingInfo doesn't allocate once it has grown to the number of cars */
+void counterInfo(const CounterContext& ctx, ParkingInfo& info) {
+    const TrackSet& tracks = ctx.tracks;
+    info.total_in = ctx.total_in;
+    info.total_out = ctx.total_out;
+    info.centroids.clear();
+    for (size_t i = 0; i < tracks.size(); i++) {
+        if (tracks.gone[i]) {
+            continue;
+        }
+        Centroid c;
+        c.id = tracks.id[i];
+        c.p = tracks.p[i];
+        c.gone_count = tracks.gone_count[i];
+        info.centroids.push_back(c);
+    }
+}
+
+// entranceBand returns the rectangle of the band along the entrance edge, band is a fraction of the frame size
+Rect entranceBand(Size size, const string& entrance, double band) {
+    int w = max(1, (int)(size.width * band));
+    int h = max(1, (int)(size.height * band));
+    if (entrance.compare("t") == 0) {
+        return Rect(0, 0, size.width, h);
+    }
+    if (entrance.compare("l") == 0) {
+        return Rect(0, 0, w, size.height);
+    }
+    if (entrance.compare("r") == 0) {
+        return Rect(size.width - w, 0, w, size.height);
+    }
+    return Rect(0, size.height - h, size.width, h);
+}
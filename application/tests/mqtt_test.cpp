@@ -0,0 +1,249 @@
+/*
+* Copyright (c) 2018 Intel Corporation.
+*
+* Permission is hereby granted, free of charge, to any person obtaining
+* a copy of this software and associated documentation files (the
+* "Software"), to deal in the Software without restriction, including
+* without limitation the rights to use, copy, modify, merge, publish,
+* distribute, sublicense, and/or sell copies of the Software, and to
+* permit persons to whom the Software is furnished to do so, subject to
+* the following conditions:
+*
+* The above copyright notice and this permission notice shall be
+* included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+* EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+* MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+* NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+* LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+* OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+* WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mqtt.h"
+#include "journal.h"
+
+using namespace std;
+
+/* This file tests the outbound queue and the journal of the MQTT publisher against a fake Paho async client.
+   The fake keeps every message it is handed until the test acknowledges or fails it, so the test decides when
+   the callbacks run. Run ./mqtt_test, it exits with an error when a check fails */
+
+// FakeSend is a message handed to the fake client which is waiting for its callback
+struct FakeSend {
+    string topic;
+    MQTTAsync_responseOptions opts;
+};
+
+static mutex fake_mutex;
+static bool fake_accept = false;
+static bool fake_connected = false;
+static MQTTAsync_connected* fake_on_connected = NULL;
+static deque<FakeSend> fake_pending;
+// fake_sends counts the messages handed to the client, fake_sends_disconnected the ones handed while disconnected
+static int fake_sends = 0;
+static int fake_sends_disconnected = 0;
+static int fake_handle;
+
+extern "C" {
+
+int MQTTAsync_create(MQTTAsync* handle, const char* serverURI, const char* clientId, int persistence_type,
+                     void* persistence_context) {
+    *handle = &fake_handle;
+    return MQTTASYNC_SUCCESS;
+}
+
+int MQTTAsync_setCallbacks(MQTTAsync handle, void* context, MQTTAsync_connectionLost* cl,
+                           MQTTAsync_messageArrived* ma, MQTTAsync_deliveryComplete* dc) {
+    return MQTTASYNC_SUCCESS;
+}
+
+int MQTTAsync_setConnected(MQTTAsync handle, void* context, MQTTAsync_connected* co) {
+    fake_on_connected = co;
+    return MQTTASYNC_SUCCESS;
+}
+
+int MQTTAsync_connect(MQTTAsync handle, const MQTTAsync_connectOptions* options) {
+    {
+        lock_guard<mutex> lock(fake_mutex);
+        if (!fake_accept) {
+            return MQTTASYNC_FAILURE;
+        }
+        fake_connected = true;
+    }
+    fake_on_connected(NULL, NULL);
+    return MQTTASYNC_SUCCESS;
+}
+
+int MQTTAsync_disconnect(MQTTAsync handle, const MQTTAsync_disconnectOptions* options) {
+    lock_guard<mutex> lock(fake_mutex);
+    fake_connected = false;
+    return MQTTASYNC_SUCCESS;
+}
+
+int MQTTAsync_isConnected(MQTTAsync handle) {
+    lock_guard<mutex> lock(fake_mutex);
+    return fake_connected;
+}
+
+int MQTTAsync_subscribe(MQTTAsync handle, const char* topic, int qos, MQTTAsync_responseOptions* response) {
+    return MQTTASYNC_SUCCESS;
+}
+
+int MQTTAsync_sendMessage(MQTTAsync handle, const char* destinationName, const MQTTAsync_message* msg,
+                          MQTTAsync_responseOptions* response) {
+    lock_guard<mutex> lock(fake_mutex);
+    fake_sends++;
+    if (!fake_connected) {
+        fake_sends_disconnected++;
+        return MQTTASYNC_DISCONNECTED;
+    }
+    FakeSend send = {destinationName, *response};
+    fake_pending.push_back(send);
+    return MQTTASYNC_SUCCESS;
+}
+
+void MQTTAsync_destroy(MQTTAsync* handle) {
+    *handle = NULL;
+}
+
+}
+
+// fakeComplete runs the callback of the oldest message waiting for one, as the broker acknowledged or refused it
+static void fakeComplete(bool success) {
+    FakeSend send;
+    {
+        lock_guard<mutex> lock(fake_mutex);
+        send = fake_pending.front();
+        fake_pending.pop_front();
+    }
+    if (success) {
+        MQTTAsync_successData data;
+        memset(&data, 0, sizeof(data));
+        send.opts.onSuccess(send.opts.context, &data);
+    } else {
+        MQTTAsync_failureData data;
+        memset(&data, 0, sizeof(data));
+        send.opts.onFailure(send.opts.context, &data);
+    }
+}
+
+// pendingTopics returns the topics of the messages waiting for their callback in the order they were sent
+static vector<string> pendingTopics() {
+    lock_guard<mutex> lock(fake_mutex);
+    vector<string> topics;
+    for (auto const &send: fake_pending) {
+        topics.push_back(send.topic);
+    }
+    return topics;
+}
+
+// waitFor waits up to a few seconds for done to return true
+static bool waitFor(function<bool()> done) {
+    chrono::steady_clock::time_point deadline = chrono::steady_clock::now() + chrono::seconds(5);
+    while (!done()) {
+        if (chrono::steady_clock::now() > deadline) {
+            return false;
+        }
+        this_thread::sleep_for(chrono::milliseconds(5));
+    }
+    return true;
+}
+
+static int failures = 0;
+
+static void check(bool ok, const string& what) {
+    if (!ok) {
+        cerr << "FAILED: " << what << endl;
+        failures++;
+    }
+}
+
+static vector<string> topicRange(int first, int last) {
+    vector<string> topics;
+    for (int k = first; k <= last; k++) {
+        topics.push_back("m" + to_string(k));
+    }
+    return topics;
+}
+
+int main(int argc, char* argv[]) {
+    string path = "mqtt_test_journal.bin";
+    unlink(path.c_str());
+    setenv("MQTT_SERVER", "tcp://localhost:1883", 1);
+    setenv("MQTT_CLIENT_ID", "mqtt_test", 1);
+    if (mqtt_start(NULL) != 0 || !mqtt_journal(path, 1 << 20)) {
+        cerr << "FAILED: unable to start the publisher" << endl;
+        return 1;
+    }
+
+    // Messages published while disconnected go to the journal
+    mqtt_publish("m0", "0", false);
+    mqtt_publish("m1", "1", false);
+    check(mqtt_stats().journaled == 2, "messages published while disconnected are journaled");
+    check(fake_sends == 0, "nothing is sent while disconnected");
+
+    // Once connected, the journaled messages are sent in order
+    {
+        lock_guard<mutex> lock(fake_mutex);
+        fake_accept = true;
+    }
+    mqtt_connect();
+    check(waitFor([]() { return pendingTopics().size() == 2; }), "journaled messages are sent once connected");
+    check(pendingTopics() == topicRange(0, 1), "journaled messages are sent in order");
+
+    // A refused message is sent again before the later ones
+    fakeComplete(true);
+    fakeComplete(false);
+    check(pendingTopics() == topicRange(1, 1), "a refused message is sent again");
+    fakeComplete(true);
+    check(mqtt_stats().sent == 2, "acknowledged messages are counted as sent");
+
+    // Fill the in-flight window and leave some messages queued behind it
+    for (int k = 2; k < 2 + MQTT_MAX_INFLIGHT + 4; k++) {
+        mqtt_publish("m" + to_string(k), to_string(k), false);
+    }
+    check(pendingTopics() == topicRange(2, 1 + MQTT_MAX_INFLIGHT), "sending stops at the in-flight window");
+
+    /* No message goes to the client once it is disconnecting, not even when an acknowledgement arrives late
+       and frees a place in the in-flight window */
+    mqtt_disconnect();
+    int sends = fake_sends;
+    fakeComplete(true);
+    check(fake_sends == sends, "nothing is sent after the disconnect");
+    check(fake_sends_disconnected == 0, "nothing is sent to a disconnected client");
+
+    // The messages in flight and the queued ones are kept in the journal for the next run, in order
+    mqtt_close();
+    MessageJournal journal;
+    vector<JournalMessage> messages;
+    check(journal.open(path, 1 << 20), "the journal can be opened again");
+    journal.take(messages, 100);
+    vector<string> topics;
+    for (auto const &msg: messages) {
+        topics.push_back(msg.topic);
+    }
+    check(topics == topicRange(3, 1 + MQTT_MAX_INFLIGHT + 4), "unacknowledged messages are journaled at close");
+    journal.close();
+    unlink(path.c_str());
+
+    if (failures > 0) {
+        return 1;
+    }
+    cout << "All MQTT publisher checks passed" << endl;
+    return 0;
+}